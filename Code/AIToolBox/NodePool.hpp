@@ -0,0 +1,233 @@
+#ifndef AI_TOOLBOX_POMDP_NODEPOOL_HEADER_FILE
+#define AI_TOOLBOX_POMDP_NODEPOOL_HEADER_FILE
+
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+namespace AIToolbox {
+  namespace POMDP {
+    /**
+     * @brief This class implements an arena of nodes addressed by 32-bit indices.
+     *
+     * Nodes are allocated by contiguous blocks, and never move once
+     * allocated: the storage is a list of chunks of doubling size
+     * (chunk c holds base * 2^c elements), so that references and
+     * pointers to a node stay valid while the pool grows. A block
+     * never spans two chunks, which allows a block of nodes to be
+     * walked with a pointer.
+     *
+     * Allocation is a bump of an atomic counter, and can be done
+     * concurrently by several threads. Clearing the pool is O(1): the
+     * chunks are kept and the nodes are reinitialized when they are
+     * allocated again.
+     *
+     * @tparam T The node type, which must be default constructible and copy assignable.
+     */
+    template <typename T>
+    class NodePool {
+    public:
+      /**
+       * @brief The index representing the absence of a node.
+       */
+      static constexpr uint32_t NONE = UINT32_MAX;
+
+      /**
+       * @brief Basic constructor.
+       *
+       * @param base The size of the first chunk, and the maximal size of a block.
+       */
+      NodePool(size_t base = 1024);
+
+      NodePool(const NodePool & other);
+      NodePool(NodePool && other);
+      NodePool & operator=(NodePool other);
+      ~NodePool();
+
+      /**
+       * @brief This function allocates a block of contiguous nodes, reset to T().
+       *
+       * This function is thread-safe.
+       *
+       * @param n The number of nodes in the block, at most the base size.
+       *
+       * @return The index of the first node of the block.
+       */
+      uint32_t allocate(size_t n);
+
+      /**
+       * @brief This function returns the node at the given index.
+       *
+       * @param i An index previously returned by allocate (or within its block).
+       *
+       * @return A reference to the node.
+       */
+      T & operator[](uint32_t i);
+      const T & operator[](uint32_t i) const;
+
+      /**
+       * @brief This function drops all the nodes in O(1), keeping the memory for later allocations.
+       */
+      void clear();
+
+      /**
+       * @brief This function returns the number of nodes allocated since the last clear.
+       *
+       * @return The number of nodes.
+       */
+      size_t size() const;
+
+      /**
+       * @brief This function returns the memory held by the pool.
+       *
+       * @return The number of bytes allocated for the chunks.
+       */
+      size_t bytes() const;
+
+      /**
+       * @brief This function swaps the content of two pools.
+       *
+       * @param other The pool to swap with.
+       */
+      void swap(NodePool & other);
+
+    private:
+      static constexpr size_t MAX_CHUNKS = 32;
+
+      /**
+       * @brief This function returns the chunk containing a given index.
+       */
+      size_t chunkOf(size_t i) const;
+
+      /**
+       * @brief This function returns the index of the first node of a chunk.
+       */
+      size_t chunkStart(size_t c) const;
+
+      /**
+       * @brief This function allocates the given chunk if needed.
+       */
+      void ensureChunk(size_t c);
+
+      size_t base_;
+      std::atomic<uint32_t> size_;
+      std::atomic<T*> chunks_[MAX_CHUNKS];
+      std::mutex grow_;
+    };
+
+    template <typename T>
+    constexpr uint32_t NodePool<T>::NONE;
+
+    template <typename T>
+    constexpr size_t NodePool<T>::MAX_CHUNKS;
+
+    template <typename T>
+    NodePool<T>::NodePool(size_t base) : base_(std::max<size_t>(1, base)), size_(0) {
+      for (size_t c = 0; c < MAX_CHUNKS; ++c) chunks_[c] = nullptr;
+    }
+
+    template <typename T>
+    NodePool<T>::NodePool(const NodePool & other) : NodePool(other.base_) {
+      size_t n = other.size();
+      for (size_t c = 0; c < MAX_CHUNKS && chunkStart(c) < n; ++c) {
+	ensureChunk(c);
+	std::copy(other.chunks_[c].load(), other.chunks_[c].load() + std::min(n, chunkStart(c + 1)) - chunkStart(c), chunks_[c].load());
+      }
+      size_ = n;
+    }
+
+    template <typename T>
+    NodePool<T>::NodePool(NodePool && other) : NodePool(other.base_) {
+      swap(other);
+    }
+
+    template <typename T>
+    NodePool<T> & NodePool<T>::operator=(NodePool other) {
+      swap(other);
+      return *this;
+    }
+
+    template <typename T>
+    NodePool<T>::~NodePool() {
+      for (size_t c = 0; c < MAX_CHUNKS; ++c) delete [] chunks_[c].load();
+    }
+
+    template <typename T>
+    uint32_t NodePool<T>::allocate(size_t n) {
+      assert(("Block larger than the pool base size", n <= base_));
+      uint32_t first = size_.load(std::memory_order_relaxed), start;
+      do {
+	// Blocks do not span chunks: skip the end of the current chunk if needed.
+	start = first;
+	size_t next = chunkStart(chunkOf(start) + 1);
+	if (start + n > next) start = next;
+	assert(("Node pool is full", start + n < NONE));
+      } while ( !size_.compare_exchange_weak(first, start + n, std::memory_order_relaxed) );
+
+      ensureChunk(chunkOf(start));
+      for (size_t i = 0; i < n; ++i) (*this)[start + i] = T();
+      return start;
+    }
+
+    template <typename T>
+    T & NodePool<T>::operator[](uint32_t i) {
+      size_t c = chunkOf(i);
+      return chunks_[c].load(std::memory_order_acquire)[i - chunkStart(c)];
+    }
+
+    template <typename T>
+    const T & NodePool<T>::operator[](uint32_t i) const {
+      size_t c = chunkOf(i);
+      return chunks_[c].load(std::memory_order_acquire)[i - chunkStart(c)];
+    }
+
+    template <typename T>
+    void NodePool<T>::clear() {
+      size_ = 0;
+    }
+
+    template <typename T>
+    size_t NodePool<T>::size() const {
+      return size_.load();
+    }
+
+    template <typename T>
+    size_t NodePool<T>::bytes() const {
+      size_t total = 0;
+      for (size_t c = 0; c < MAX_CHUNKS; ++c)
+	if (chunks_[c].load()) total += (chunkStart(c + 1) - chunkStart(c)) * sizeof(T);
+      return total;
+    }
+
+    template <typename T>
+    void NodePool<T>::swap(NodePool & other) {
+      std::swap(base_, other.base_);
+      size_ = other.size_.exchange(size_.load());
+      for (size_t c = 0; c < MAX_CHUNKS; ++c)
+	chunks_[c] = other.chunks_[c].exchange(chunks_[c].load());
+    }
+
+    template <typename T>
+    size_t NodePool<T>::chunkOf(size_t i) const {
+      // Chunk c covers [base * (2^c - 1), base * (2^(c+1) - 1))
+      return 63 - __builtin_clzll(i / base_ + 1);
+    }
+
+    template <typename T>
+    size_t NodePool<T>::chunkStart(size_t c) const {
+      return base_ * ((size_t(1) << c) - 1);
+    }
+
+    template <typename T>
+    void NodePool<T>::ensureChunk(size_t c) {
+      if ( chunks_[c].load(std::memory_order_acquire) ) return;
+      std::lock_guard<std::mutex> lock(grow_);
+      if ( !chunks_[c].load(std::memory_order_relaxed) )
+	chunks_[c].store(new T[chunkStart(c + 1) - chunkStart(c)], std::memory_order_release);
+    }
+  }
+}
+
+#endif
@@ -5,8 +5,26 @@
 #include <AIToolbox/ProbabilityUtils.hpp>
 #include <AIToolbox/Impl/Seeder.hpp>
 
-#include <unordered_map>
+#include "NodePool.hpp"
+#include "ParticleCounts.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <limits>
+#include <cmath>
 #include <iostream>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <string>
+#include <fstream>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 namespace AIToolbox {
   namespace POMDP {
@@ -24,27 +42,85 @@ namespace AIToolbox {
     template <typename M>
     class PAMCP<M> {
     public:
-      using SampleBelief = std::vector<size_t>;
+      using SampleBelief = ParticleCounts; // Particles by environment, they all share the observation of their node
+      using Clock = std::chrono::steady_clock;
+      // Storage of the exact beliefs in the tree. Building with
+      // PAMCP_FLOAT_BELIEFS halves their memory.
+#ifdef PAMCP_FLOAT_BELIEFS
+      using EnvProb = float;
+#else
+      using EnvProb = double;
+#endif
 
-      struct BeliefNode;
-      using BeliefNodes = std::unordered_map<size_t, BeliefNode>;
+      // Index of a missing node in the tree pools.
+      static constexpr uint32_t NONE = UINT32_MAX;
+
+      // Action statistics are stored by arrays: a belief node owns the
+      // contiguous stats V[A], N[A] and VL[A]. They are atomic so that
+      // several threads can share the tree (see setThreads). VL counts
+      // the simulations currently going through the action (virtual loss).
+      // With progressive widening, the stats and the children of a node
+      // are indexed by the rank of the action for its observation.
+      struct Stat {
+	Stat() : value(0.0) {}
+	Stat(const Stat & other) : value(other.value.load()) {}
+	Stat & operator=(const Stat & other) { value = other.value.load(); return *this; }
+	std::atomic<double> value;
+      };
 
-      struct ActionNode {
-	BeliefNodes children;
-	double V = 0.0;
-	unsigned N = 0;
+      // A slot holds the first link slot of an action, or the belief
+      // node reached through a link.
+      struct Slot {
+	Slot() : node(NONE) {}
+	Slot(const Slot & other) : node(other.node.load()) {}
+	Slot & operator=(const Slot & other) { node = other.node.load(); return *this; }
+	std::atomic<uint32_t> node;
       };
-      using ActionNodes = std::vector<ActionNode>;
 
       struct BeliefNode {
-	BeliefNode() : obs(0), N(0) {}
-	BeliefNode(size_t o) : obs(o), N(0) {}
-	BeliefNode(size_t o, size_t s) : obs(o), smplbelief(1, s), N(0) {}
-	ActionNodes children;
+	BeliefNode() : actions(NONE), children(NONE), ranks(0), obs(0), envbelief(NONE), N(0) {}
+	BeliefNode(const BeliefNode & other) : actions(other.actions.load()), children(other.children), ranks(other.ranks), obs(other.obs), envbelief(other.envbelief), N(other.N.load()), smplbelief(other.smplbelief) {}
+	BeliefNode & operator=(const BeliefNode & other) { actions = other.actions.load(); children = other.children; ranks = other.ranks; obs = other.obs; envbelief = other.envbelief; N = other.N.load(); smplbelief = other.smplbelief; return *this; }
+	std::atomic<uint32_t> actions; // First of the 3 * ranks action stats, NONE until the node is descended into
+	uint32_t children; // First of the ranks action slots
+	uint32_t ranks; // Number of ranked actions with stats and slots (see expand)
+	uint32_t obs;
+	uint32_t envbelief; // First of the E entries of the exact belief, NONE until the node is descended into
+	std::atomic<unsigned> N;
 	SampleBelief smplbelief;
-	Belief envbelief;
-	size_t obs;
-	unsigned N;
+      };
+
+      /**
+       * @brief An entry of the transposition table.
+       */
+      struct Transposition {
+	uint32_t node;
+	uint32_t togo; // Remaining horizon of the node
+      };
+
+      /**
+       * @brief A search tree stored in node pools.
+       *
+       * Nodes are addressed by 32-bit indices. The children of an
+       * action are a dense array of slots, one per link: the
+       * links of observation o are the observations reachable from o
+       * in at least one environment (see the constructor). Clearing
+       * a tree is O(1).
+       */
+      struct Tree {
+	// Approximate size of an entry of the transposition table
+	static constexpr size_t TRANSPOSITION_BYTES = sizeof(std::pair<uint64_t, Transposition>) + 3 * sizeof(void*);
+	Tree(size_t base = 1024) : beliefs(base), stats(base), slots(base), envbeliefs(base), root(NONE) {}
+	void clear() { beliefs.clear(); stats.clear(); slots.clear(); envbeliefs.clear(); transpositions.clear(); root = NONE; }
+	void swap(Tree & other) { beliefs.swap(other.beliefs); stats.swap(other.stats); slots.swap(other.slots); envbeliefs.swap(other.envbeliefs); transpositions.swap(other.transpositions); std::swap(root, other.root); }
+	size_t bytes() const { return beliefs.bytes() + stats.bytes() + slots.bytes() + envbeliefs.bytes() + transpositions.size() * TRANSPOSITION_BYTES; }
+	size_t used() const { return beliefs.size() * sizeof(BeliefNode) + stats.size() * sizeof(Stat) + slots.size() * sizeof(Slot) + envbeliefs.size() * sizeof(EnvProb) + transpositions.size() * TRANSPOSITION_BYTES; }
+	NodePool<BeliefNode> beliefs;
+	NodePool<Stat> stats;
+	NodePool<Slot> slots;
+	NodePool<EnvProb> envbeliefs;
+	std::unordered_map<uint64_t, Transposition> transpositions; // Nodes by remaining horizon, observation and quantized belief, see setTranspositions
+	uint32_t root;
       };
 
       /**
@@ -64,6 +140,9 @@ namespace AIToolbox {
        * @brief This function resets the internal graph and samples
        * for the provided belief and horizon.
        *
+       * With a past-aware tree, a new session restarts from the root
+       * kept from the previous sessions: the tree is not copied and
+       * keeps growing in place.
        *
        * @param be The initial belief online environment.
        * @param o The initial observation / user history
@@ -82,9 +161,10 @@ namespace AIToolbox {
        *
        * If a graph is already present though, this function will
        * select the branch defined by the input action and
-       * observation, and prune the rest. The search will be started
-       * using the existing graph: this should make search faster,
-       * and also not require any belief updates.
+       * observation, and prune the rest (unless the tree is
+       * past-aware, in which case the root simply moves down). The
+       * search will be started using the existing graph: this should
+       * make search faster, and also not require any belief updates.
        *
        * NOTE: Currently there is no particle reinvigoration
        * implemented, so for long horizons you can expect
@@ -98,17 +178,60 @@ namespace AIToolbox {
        */
       size_t sampleAction(size_t a, size_t o, unsigned horizon);
 
+      /**
+       * @brief This function resets the internal graph and samples
+       * for the provided belief and horizon until a deadline.
+       *
+       * Simulations are run until the deadline instead of for a
+       * fixed number of iterations. The clock is checked every few
+       * simulations, and the best action found so far is returned;
+       * getSimulations() tells how many simulations were run.
+       *
+       * @param be The initial belief online environment.
+       * @param o The initial observation / user history
+       * @param horizon The horizon to plan for.
+       * @param deadline The time at which the search stops.
+       *
+       * @return The best action.
+       */
+      size_t sampleAction(const Belief& be, size_t o, unsigned horizon, Clock::time_point deadline, bool start_session=false);
+
+      /**
+       * @brief This function uses the internal graph to plan until a deadline.
+       *
+       * @param a The action taken in the last timestep.
+       * @param o The observation received in the last timestep.
+       * @param horizon The horizon to plan for.
+       * @param deadline The time at which the search stops.
+       *
+       * @return The best action.
+       */
+      size_t sampleAction(size_t a, size_t o, unsigned horizon, Clock::time_point deadline);
+
       /**
        * @brief This function sets the new size for initial beliefs created from sampleAction().
        *
        * Note that this parameter does not bound particle beliefs
        * created within the tree by result of rollouts: only the ones
-       * directly created from true Beliefs.
+       * directly created from true Beliefs (see setParticleCap).
        *
        * @param beliefSize The new particle belief size.
        */
       void setBeliefSize(size_t beliefSize);
 
+      /**
+       * @brief This function bounds the number of particles of the beliefs within the tree.
+       *
+       * Particle beliefs are histograms over environments, so their
+       * memory is O(E) anyway. Without a cap their mass grows by one
+       * particle per visit; with a cap, a particle reaching a full
+       * belief replaces a particle drawn at random, so that the
+       * belief follows the most recent visits.
+       *
+       * @param particles The maximal number of particles of a belief node (0 for no cap).
+       */
+      void setParticleCap(unsigned particles);
+
       /**
        * @brief This function sets the number of performed rollouts in POMCP.
        *
@@ -130,413 +253,2900 @@ namespace AIToolbox {
       void setExploration(double exp);
 
       /**
-       * @brief This function returns the POMDP generative model being used.
+       * @brief This function sets the number of threads used to plan for an action.
        *
-       * @return The POMDP generative model.
+       * By default, PAMCP uses root parallelization: each thread
+       * grows an independent tree from the same root belief with its
+       * own random engine, and the iterations are split between
+       * them. At decision time, the statistics of the root actions
+       * are merged across trees to select the action. Each tree then
+       * carries forward its own subtree for the observed (action,
+       * observation) branch.
+       *
+       * With shared_tree, all threads instead cooperate on the
+       * single search tree (tree parallelization): node statistics
+       * are updated lock-free, node expansions are serialized per
+       * action node, and a virtual loss (see setVirtualLoss) keeps
+       * threads from all descending the same UCT path.
+       *
+       * @param threads The number of threads (1 disables parallelization).
+       * @param shared_tree If True, threads share a single tree.
        */
-      const M& getModel() const;
+      void setThreads(unsigned threads, bool shared_tree = false);
 
       /**
-       * @brief This function returns the implicit/explicit belief environment maintained by the model
+       * @brief This function sets the virtual loss used with a shared tree or batched rollouts.
        *
-       * @return The belief over environment
+       * While a simulation is going through an action node, UCT
+       * evaluates that action as if each pending simulation had
+       * returned -vl. The penalty is removed during the backup.
+       *
+       * @param vl The virtual loss, in reward units.
        */
-      const std::vector<double> getEnvBelief() const;
+      void setVirtualLoss(double vl);
 
       /**
-       * @brief This function returns a reference to the internal graph structure holding the results of rollouts.
+       * @brief This function sets the number of simulations whose rollouts are run together.
        *
-       * @return The internal graph.
+       * The simulations of a batch first descend the tree one after
+       * the other, counting as a virtual loss (see setVirtualLoss)
+       * on the actions they go through so that they spread over the
+       * tree. Their rollouts then advance in lockstep, and their
+       * returns are backed up.
+       *
+       * @param n The batch size (1 backs up each simulation before the next one).
        */
-      const BeliefNode& getGraph() const;
+      void setRolloutBatch(unsigned n);
 
       /**
-       * @brief This function returns the initial particle size for converted Beliefs.
+       * @brief This function sets how the leaves of the tree are evaluated.
        *
-       * @return The initial particle count.
+       * By default, a new leaf is evaluated by a random rollout until
+       * the horizon. Otherwise, the MDP of each environment is solved
+       * by finite-horizon value iteration, and a leaf is evaluated by
+       * the optimal value of its state in each environment with the
+       * remaining steps, weighted by the belief of the parent node
+       * (or in the environment of the simulated state with particle
+       * beliefs). This is an optimistic estimate, since the
+       * environment is assumed to be known, but without variance.
+       *
+       * @param mdp If True, evaluate leaves with the MDP values.
+       * @param horizon The values are solved now up to this horizon, larger horizons are solved when first searched.
        */
-      size_t getBeliefSize() const;
+      void setLeafEvaluation(bool mdp, unsigned horizon = 0);
 
       /**
-       * @brief This function returns the number of iterations performed to plan for an action.
+       * @brief This function sets the action distribution of the rollouts.
        *
-       * @return The number of iterations.
+       * By default, rollouts choose actions uniformly. Otherwise, the
+       * action at a state is sampled proportionally to the weights
+       * of its row, with alias tables built here. Rows are either
+       * per observation (O rows) or per state (S rows, so one
+       * distribution per environment and observation). Rows summing
+       * to 0 are sampled uniformly.
+       *
+       * @param weights The weights of the actions, row by row (empty for uniform rollouts).
        */
-      unsigned getIterations() const;
+      void setRolloutPolicy(const std::vector<double> & weights);
 
       /**
-       * @brief This function returns the currently set exploration constant.
+       * @brief This function enables the stratified sampling of the root environments.
        *
-       * @return The exploration constant.
+       * With exact beliefs, the environment of each simulation is
+       * drawn from the root belief through an alias table built once
+       * per decision. With stratification, the n simulations of a
+       * search instead get the environments at the quantiles
+       * (k + u) / n of the belief, for a single uniform u, in a random
+       * order: each environment gets its share of simulations up to
+       * one, which lowers the variance of the root estimates.
+       * Searches with a time budget keep the alias table.
+       *
+       * @param stratified If True, stratify the root environments.
        */
-      double getExploration() const;
-
-    private:
-      const M& model_;
-      size_t S, A, O, E, beliefSize_;
-      unsigned iterations_, maxDepth_;
-      double exploration_;
-
-      BeliefNode graph_;
-      BeliefNode fullgraph_;
-      std::vector<std::pair<size_t, size_t> > history;
-      bool reset_belief = true;
-      bool to_update;
-      bool with_tree;
-      bool with_exact_belief;
+      void setStratifiedRoot(bool stratified);
 
-      mutable std::default_random_engine rand_;
+      /**
+       * @brief This function enables progressive widening over actions.
+       *
+       * The actions of each observation are ranked once by a prior:
+       * their rollout policy weight if one is set (see
+       * setRolloutPolicy), otherwise their expected immediate reward
+       * averaged over the environments. UCT then only considers the
+       * ceil(c * N^alpha) best ranked actions of a node visited N
+       * times, so that large action sets are not tried one by one.
+       * Nodes only store the stats of these actions, and grow as
+       * their width does (see expand), so that their memory does not
+       * scale with A either.
+       *
+       * This must be set before the first search, and after the
+       * rollout policy.
+       *
+       * @param c The widening constant (0 considers all the actions).
+       * @param alpha The widening exponent.
+       */
+      void setProgressiveWidening(double c, double alpha = 0.5);
 
       /**
-       * @brief This function starts the simulation process.
+       * @brief This function enables a transposition table in the search trees.
        *
-       * This function simply calls simulate() for the number of
-       * times specified by POMCP's parameters. While doing so it
-       * builds a tree of explored outcomes, from which POMCP will
-       * then extract the best expected action for the current
-       * belief.
+       * With exact beliefs, nodes with the same observation and the
+       * same belief up to the given resolution are merged, whatever
+       * the path leading to them: the tree becomes a graph whose
+       * statistics are shared by all the paths. The beliefs of the
+       * new nodes are then computed when they are created. Only nodes
+       * with the same remaining horizon are merged, so that their
+       * returns cover the same number of steps and no path loops back
+       * to an ancestor. The table is keyed by a hash, and a hit is
+       * checked against the horizon and the belief of the node.
        *
-       * @param horizon The horizon for which to plan.
+       * Every new node then stores its belief, leaves included, and
+       * a table entry. Without the past-aware tree (pomcpex), few
+       * nodes are reached twice within one search, so this costs
+       * memory for no gain: the table pays off with pamcpex.
        *
-       * @return The best action to take given the final built tree.
+       * This must be set before the first search.
+       *
+       * @param levels The number of quantization levels of a belief entry (0 disables the table).
        */
-      size_t runSimulation(unsigned horizon);
+      void setTranspositions(unsigned levels);
 
       /**
-       * @brief This function recursively simulates the model while building the tree.
+       * @brief This function restricts the searches to the likely environments.
        *
-       * From the given belief node, state and horizon, this function
-       * selects an action based on UCT (so that estimated good
-       * actions are taken more often than estimated bad actions) and
-       * samples a new state, observation and reward. Based on the
-       * observation, the function detects whether it is at the end
-       * of the tree or not. If it is, it adds a new node to the tree
-       * and rollouts the rest of the episode. Otherwise it
-       * recursively traverses the tree.
+       * With exact beliefs, the root keeps its exact belief over all
+       * the environments, updated once per decision. The search only
+       * considers its support: the environments with at least the
+       * given mass, at most k of them (the most likely one is always
+       * kept). The belief of the root is renormalized over the
+       * support, and the belief updates of the search touch only the
+       * support, so their cost scales with its size instead of E (the
+       * nodes still store E entries, see materialize). The mass left
+       * out (see getResidualMass) is tracked by the exact belief:
+       * environments come back in the support as soon as an
+       * observation makes them likely again.
        *
-       * The states and rewards obtained on the way are used to
-       * update particle beliefs within the tree and the value
-       * estimations for those beliefs.
+       * @param threshold The minimal mass of an environment of the support (0 for none).
+       * @param k The maximal size of the support (0 for no limit).
+       */
+      void setBeliefSupport(double threshold, unsigned k = 0);
+
+      /**
+       * @brief This function lets the searches merge similar environments while the belief is diffuse.
        *
-       * @param b The tree node to simulate from.
-       * @param s The state from which we are simulating, possibly a particle of a previous particle belief.
-       * @param horizon The depth within the tree already reached.
+       * The environments are first clustered into a hierarchy, by
+       * average linkage on the symmetrized KL divergence of their
+       * transitions. Before each search, the hierarchy is cut so that
+       * every cluster holding more than the given mass of the root
+       * belief is split into its two children: while the belief is
+       * diffuse the search only sees a few coarse clusters, and it
+       * refines them down to single environments as the belief
+       * concentrates. Each cluster is simulated by its medoid
+       * environment, with the mass of the whole cluster, and the
+       * support restrictions of setBeliefSupport apply to the
+       * clusters. The exact belief over the environments is kept as
+       * with setBeliefSupport.
        *
-       * @return The discounted reward obtained from the simulation performed from here to the end.
+       * The medoids only carry the mass of their cluster inside the
+       * searches: getEnvBelief, the budget schedule and the switch to
+       * the MDP policy of setIdentifiedPolicy use the exact belief, so
+       * a coarse cluster never counts as an identified environment.
+       *
+       * @param threshold The mass above which a cluster is split (0 disables clustering).
        */
-      double simulate(BeliefNode & b, size_t s, unsigned horizon);
+      void setEnvironmentClusters(double threshold);
 
       /**
-       * @brief This function implements the rollout policy for POMCP.
+       * @brief This function enables the opening book.
        *
-       * This function extracts some cumulative reward from a
-       * particular state, given that we have reached a particular
-       * horizon. The idea behind this function is to approximate the
-       * true value of the state; since this function is called when
-       * we are at the leaves of our tree, the only way for us to
-       * extract more information is to simply simulate the rest of
-       * the episode directly.
+       * The opening book keeps the root statistics of the first
+       * decisions of the sessions across sessions, keyed by the
+       * observation, the horizon and the quantized root belief. The
+       * statistics of the searches with the same key are merged (or
+       * replaced with a past-aware tree, whose root statistics
+       * already accumulate), and once an entry holds enough
+       * simulations the decision is read from the book instead of
+       * searched. The children of such a root are added from the
+       * exact belief when the next observation arrives.
        *
-       * However, in order to speed up the process and store only
-       * useful data, we avoid inserting every single state that we
-       * see here into the tree, preferring to add a single state at
-       * a time. This avoids wasting lots of computation and memory
-       * on states far from our root that we will probably never see
-       * again, while at the same time still getting an estimate for
-       * the rest of the simulation.
+       * This requires exact beliefs.
+       *
+       * @param depth The number of decisions from the start of a session that use the book (0 disables it).
+       * @param levels The number of quantization levels of a belief entry.
+       * @param simulations The number of root simulations an entry needs to be used (0 for the number of iterations).
+       * @param refresh If not 0, every refresh-th use of an entry searches again and updates it.
+       */
+      void setOpeningBook(unsigned depth, unsigned levels = 100, unsigned simulations = 0, unsigned refresh = 0);
+
+      /**
+       * @brief This function fills the opening book entry of a belief.
+       *
+       * Searches are run from the belief until its entry holds the
+       * simulations it needs to be used. This stops early if a
+       * search does not add to the entry, e.g. when the belief is
+       * played with the identified MDP policy.
        *
-       * @param s The state from which to start the rollout.
-       * @param horizon The horizon already reached while simulating inside the tree.
+       * @param be The belief over environments.
+       * @param o The observation.
+       * @param horizon The horizon to plan for.
        *
-       * @return An estimate return computed from simulating until max depth.
+       * @return True if the entry can be used.
        */
-      double rollout(size_t s, unsigned horizon);
+      bool warmOpeningBook(const Belief & be, size_t o, unsigned horizon);
 
+      /**
+       * @brief This function writes the opening book to a file.
+       *
+       * @param path The output file.
+       */
+      void saveOpeningBook(const std::string & path) const;
 
       /**
-       * @brief This function finds the best action based on value.
+       * @brief This function reads the opening book from a file written by saveOpeningBook.
+       *
+       * The entries are merged into the current book.
        *
-       * @tparam Iterator An iterator to an ActionNode.
-       * @param begin The beginning of a list of ActionNodes.
-       * @param end The end of the list.
+       * @param path The input file.
        *
-       * @return The iterator to the ActionNode with the best value.
+       * @return False if the file could not be opened.
        */
-      template <typename Iterator>
-      Iterator findBestA(Iterator begin, Iterator end);
+      bool loadOpeningBook(const std::string & path);
 
       /**
-       * @brief This function finds the best action based on UCT.
+       * @brief This function sets the memory budget of the past-aware tree.
        *
-       * UCT gives a bonus to actions that have been tried very few
-       * times, in order to void thinking that a bad action is bad
-       * just because it got unlucky the few times that it tried it.
+       * When a session starts and the tree uses more than the
+       * budget, the least visited subtrees are pruned until the
+       * tree fits in 3/4 of it. A pruned subtree is summarized by
+       * the statistics of the action leading to it, and its belief
+       * is recomputed if the search reaches it again.
        *
-       * @tparam Iterator An iterator to an ActionNode.
-       * @param begin The beginning of a list of ActionNodes.
-       * @param end The end of the list.
-       * @param count The sum of all action counts.
+       * @param bytes The memory budget in bytes (0 for no limit).
+       */
+      void setMemoryBudget(size_t bytes);
+
+      /**
+       * @brief This function sets a time budget for the sampleAction calls without deadline.
        *
-       * @return The iterator to the ActionNode to be selected based on UCT.
+       * When set, these calls run simulations for the given time
+       * instead of for the number of iterations.
+       *
+       * @param ms The time budget per decision in milliseconds (0 to use the number of iterations).
        */
-      template <typename Iterator>
-      Iterator findBestBonusA(Iterator begin, Iterator end, unsigned count);
+      void setTimeBudget(double ms);
 
       /**
-       * @brief This function samples a given belief in order to produce a particle approximation of it.
+       * @brief This function enables stopping a search once the best root action is separated from the others.
        *
-       * @param b The belief (over environment) to be approximated.
-       * @param o The current observation to determine the belief
-       * over states.
+       * The returns of the root actions in the current search are
+       * tracked with their variance. Every interval simulations, the
+       * search stops if the action with the best mean return in the
+       * current search has an empirical Bernstein lower bound above
+       * the upper bound of every other action, each bound holding
+       * with probability 1 - delta / (A - 1). That action must also
+       * be the recommended one, since the root statistics of a
+       * past-aware tree include the earlier searches. The range of
+       * the returns is the range observed in the search. Actions not
+       * tried in the current search (but those left out by
+       * progressive widening) prevent stopping.
        *
-       * @return A particle belief approximating the input belief.
+       * @param delta The confidence level of the bounds (0 disables early stopping).
+       * @param interval The number of simulations between two checks.
        */
-      SampleBelief makeSampledBelief(const Belief & b, size_t o);
+      void setEarlyStop(double delta, unsigned interval = 100);
 
       /**
-       * @brief This function updates the full graph with the current state of the simulation.
-       * More precisely, the last branch/actionNode corresponding to the current history is
-       * replaced by the currently build tree.
+       * @brief This function spreads the simulations of a session according to the uncertainty of each decision.
+       *
+       * Each decision gets a weight
+       *
+       *     w = floor + (1 - floor) * H(b) / log(E) * h / h0
        *
-       * @param current The subtree computed for action a.
-       * @param a The last action taken in the simulation.
+       * where H(b) is the entropy of the root environment belief, h
+       * the horizon of the decision and h0 the horizon at the start of
+       * the session. Decisions taken while the environment is unknown
+       * get more simulations, decisions once it is identified get
+       * fewer. A decision runs iterations * w / mean(w) simulations,
+       * where the mean is over all the decisions so far, so that the
+       * total compute matches the constant budget on average. A time
+       * budget is scaled the same way.
+       *
+       * With a session budget, a decision never runs more than what is
+       * left of it, and at least A simulations.
+       *
+       * @param floor The weight of a decision with an identified environment (1 for a constant budget).
+       * @param sessionBudget The number of simulations of a session (0 for no limit).
        */
-      //void update_fullgraph(ActionNode current, size_t a);
-      void update_fullgraph(BeliefNode current, size_t a);
-    };
+      void setBudgetSchedule(double floor, unsigned sessionBudget = 0);
 
-    template <typename M>
-    PAMCP<M>::PAMCP(const M& m, size_t beliefSize, unsigned iter, double exp, bool with_tree_/*=false*/, bool with_exact_belief_/*=true*/) : model_(m), S(model_.getS()), A(model_.getA()), O(model_.getO()), E(model_.getE()), beliefSize_(beliefSize), iterations_(iter), exploration_(exp), graph_(), with_tree(with_tree_), with_exact_belief(with_exact_belief_), rand_(Impl::Seeder::getSeed()) {}
+      /**
+       * @brief This function sets the confidence above which the environment is considered identified.
+       *
+       * Once the root environment belief puts more than this mass on
+       * one environment (the fraction of the particles, with sampled
+       * beliefs), decisions skip the search and play the optimal
+       * policy of the MDP of that environment, read from a table
+       * solved here. The belief is still updated after each decision,
+       * so the search resumes as soon as an observation brings the
+       * belief back below the threshold.
+       *
+       * @param threshold The confidence of the identification (0 to always search).
+       * @param horizon The horizon of the MDP policies.
+       */
+      void setIdentifiedPolicy(double threshold, unsigned horizon);
 
-    template <typename M>
-    size_t PAMCP<M>::sampleAction(const Belief& be, size_t o, unsigned horizon, bool start_session /* false */) {
-      // Reset graph initially or with new belief (e.g. observation missing)
-      if (reset_belief || ! with_tree) {
-	graph_ = BeliefNode(o);
-	graph_.children.resize(A);
-	reset_belief = false;
-      }
-      // Reset with the stored information
-      else {
-	graph_ = fullgraph_;
-      }
-      
-      // Initialize full graph
-      if (with_tree && start_session && history.size() == 0) {
-	fullgraph_ = BeliefNode(o);
-	fullgraph_.children.resize(A);
-      }
+      /**
+       * @brief This function enables pondering between decisions.
+       *
+       * After each decision, a background thread keeps running
+       * simulations until the next sampleAction call, which stops it.
+       * They start from the children of the root, each in the child
+       * (a, o) drawn with a probability proportional to the
+       * visits of a at the root times the probability of observing o
+       * after a under the root belief: the next root is most likely
+       * among them. When the next search starts from a child of the
+       * root, the simulations pondered in that child count towards
+       * its number of iterations (not towards a time budget).
+       *
+       * Pondering only pays off when there is think time between two
+       * decisions (e.g. an interactive user, or the think time of the
+       * driver). Without it, sampleAction is called right after the
+       * previous one and stops the thread before it runs any
+       * simulation: the option then costs a thread and credits
+       * nothing to the next search.
+       *
+       * The getters of the root statistics and memory wait for the
+       * current chunk of pondered simulations. Copies do not ponder.
+       *
+       * @param simulations The maximal number of simulations pondered between two decisions (0 disables pondering).
+       */
+      void setPondering(unsigned simulations);
 
-      // Clear history if beginning
-      if (with_tree && start_session) {
-	history.clear();
-	to_update = true;
-      }
+      /**
+       * @brief This function returns the POMDP generative model being used.
+       *
+       * @return The POMDP generative model.
+       */
+      const M& getModel() const;
 
-      // Init the env belief
-      if (with_exact_belief) {
-	graph_.envbelief = be;
-      } else {	
-	graph_.smplbelief = makeSampledBelief(be, o);
-      }
+      /**
+       * @brief This function returns the implicit/explicit belief environment maintained by the model
+       *
+       * @return The belief over environment
+       */
+      const std::vector<double> getEnvBelief() const;
 
-      return runSimulation(horizon);
-    }
+      /**
+       * @brief This function returns a reference to the internal graph structure holding the results of rollouts.
+       *
+       * @return The internal graph.
+       */
+      const Tree& getGraph() const;
 
-    template <typename M>
-    size_t PAMCP<M>::sampleAction(size_t a, size_t o, unsigned horizon) {
-      // Update full graph
-      if (with_tree && to_update) {
-	update_fullgraph(graph_, a);
-	history.push_back(std::make_pair(a, o));
-      }
+      /**
+       * @brief This function returns the value estimates of the actions at the root of the graph.
+       *
+       * @return The value of each action.
+       */
+      std::vector<double> getActionScores() const;
 
-      // Run simulation
-      auto & obs = graph_.children[a].children;
+      /**
+       * @brief This function returns the initial particle size for converted Beliefs.
+       *
+       * @return The initial particle count.
+       */
+      size_t getBeliefSize() const;
 
-      auto it = obs.find(o);
-      if ( it == obs.end() ) {
-	std::cerr << "\nObservation " << o << " never experienced in simulation, restarting belief from " << o << "\n";
-	auto b = Belief(E); b.fill(1.0 / E);
-	reset_belief = true;
-	to_update = false; // stop retaining information in case of failure
-	return sampleAction(b, o, horizon, false);
-      }
+      /**
+       * @brief This function returns the maximal number of particles of the beliefs within the tree.
+       *
+       * @return The number of particles (0 if there is no cap).
+       */
+      unsigned getParticleCap() const;
 
-      // Here we need an additional step, because *it is contained by graph_.
-      // If we just move assign, graph_ is first going to delete everything it
-      // contains (included *it), and then we are going to move unallocated memory
-      // into graph_! So we move *it outside of the graph_ hierarchy, so that
-      // we can then assign safely.
-      { auto tmp = std::move(it->second); graph_ = std::move(tmp); }
+      /**
+       * @brief This function returns the number of iterations performed to plan for an action.
+       *
+       * @return The number of iterations.
+       */
+      unsigned getIterations() const;
 
-      if ( (with_exact_belief && ! graph_.envbelief.size()) || (! with_exact_belief && ! graph_.smplbelief.size()) ) {
-	std::cerr << "POMCP Lost track of the belief, restarting with uniform..\n";
-	auto b = Belief(E); b.fill(1.0 / E);
-	reset_belief = true;
-	to_update = false;
-	return sampleAction(b, o, horizon);
-      }
+      /**
+       * @brief This function returns the currently set exploration constant.
+       *
+       * @return The exploration constant.
+       */
+      double getExploration() const;
 
-      // We resize here in case we didn't have time to sample the new
-      // head node. In this case, the new head may not have children.
-      // This would break the UCT call.
-      graph_.children.resize(A);
+      /**
+       * @brief This function returns the number of threads used to plan for an action.
+       *
+       * @return The number of threads.
+       */
+      unsigned getThreads() const;
 
-      return runSimulation(horizon);
-    }
+      /**
+       * @brief This function returns whether the threads share a single search tree.
+       *
+       * @return True for tree parallelization, False for root parallelization.
+       */
+      bool getSharedTree() const;
 
+      /**
+       * @brief This function returns the virtual loss used with a shared tree.
+       *
+       * @return The virtual loss.
+       */
+      double getVirtualLoss() const;
 
-    template <typename M>
+      /**
+       * @brief This function returns the number of simulations whose rollouts are run together.
+       *
+       * @return The batch size.
+       */
+      unsigned getRolloutBatch() const;
 
-    void PAMCP<M>::update_fullgraph(BeliefNode current, size_t a) {
-      auto & current_branch = fullgraph_;
-      // Browse history
-      for (auto it = history.begin(); it != history.end(); ++it) {
-	auto  an = current_branch.children[std::get<0>(*it)];
-	current_branch = an.children[std::get<1>(*it)];
-      }
-      // Modify
-      current_branch = current;
-    }
+      /**
+       * @brief This function returns the progressive widening constant.
+       *
+       * @return The widening constant (0 if all the actions are considered).
+       */
+      double getProgressiveWidening() const;
 
+      /**
+       * @brief This function returns the quantization of the transposition table.
+       *
+       * @return The number of quantization levels (0 if there is no table).
+       */
+      unsigned getTranspositions() const;
 
+      /**
+       * @brief This function returns the number of environments searched for the last decision.
+       *
+       * @return The size of the support (E if searches are not restricted).
+       */
+      size_t getBeliefSupport() const;
 
-    template <typename M>
-    size_t PAMCP<M>::runSimulation(unsigned horizon) {
-      if ( !horizon ) return 0;
-      maxDepth_ = horizon;
-      
-      if (with_exact_belief) {
-	for (unsigned i = 0; i < iterations_; ++i )
-	  simulate(graph_, O *  sampleProbability(E, graph_.envbelief, rand_) + graph_.obs, 0);
-      } else {
-	std::uniform_int_distribution<size_t> generator(0, graph_.smplbelief.size() - 1);
-	for (unsigned i = 0; i < iterations_; ++i )
-	  simulate(graph_, graph_.smplbelief.at(generator(rand_)), 0);
-      }
+      /**
+       * @brief This function returns the mass of the root belief left out of the support.
+       *
+       * @return The residual mass (0 if searches are not restricted).
+       */
+      double getResidualMass() const;
 
-      auto begin = std::begin(graph_.children);
-      return std::distance(begin, findBestA(begin, std::end(graph_.children)));
-    }
+      /**
+       * @brief This function returns the mass above which a cluster of environments is split.
+       *
+       * @return The clustering threshold (0 if disabled).
+       */
+      double getEnvironmentClusters() const;
 
-    template <typename M>
-    double PAMCP<M>::simulate(BeliefNode & b, size_t s, unsigned depth) {
-      b.N++;
-      auto begin = std::begin(b.children);
-      size_t a = std::distance(begin, findBestBonusA(begin, std::end(b.children), b.N));
+      /**
+       * @brief This function returns the number of decisions of a session that use the opening book.
+       *
+       * @return The depth of the book (0 if there is no book).
+       */
+      unsigned getOpeningBook() const;
 
-      size_t s1, o; double rew;
-      std::tie(s1, o, rew) = model_.sampleSOR(s, a);
-      auto & aNode = b.children[a];
-      {
-	double futureRew = 0.0;
-	// We need to append the node anyway to perform the belief
-	// update for the next timestep.
-	auto ot = aNode.children.find(o);
-	if ((ot == std::end(aNode.children))) {
-	  if (with_exact_belief) {
-	    aNode.children.emplace(std::piecewise_construct,
-				   std::forward_as_tuple(o),
-				   std::forward_as_tuple(o));
-	    // Update the envbelief of the newly created node
-	    double nrm = 0;
-	    aNode.children[o].envbelief.resize(E);
-	    for (int i = 0; i < E; i++) {
-	      aNode.children[o].envbelief(i) = b.envbelief(i) * model_.getTransitionProbability(i * O + b.obs, a, i * O + o);
-	      nrm += aNode.children[o].envbelief(i);
-	    }
-	    for (int i = 0; i < E; i++) {
-	      aNode.children[o].envbelief(i) /= nrm;
-	    }
-	  } else {
-	    aNode.children.emplace(std::piecewise_construct,
-				   std::forward_as_tuple(o),
-				   std::forward_as_tuple(o, s1));
-	  }
+      /**
+       * @brief This function returns the number of entries of the opening book.
+       *
+       * @return The number of entries.
+       */
+      size_t getOpeningBookSize() const;
 
-	  // get the reward
-	  // This stops automatically if we go out of depth
-	  futureRew = rollout(s, depth + 1);
+      /**
+       * @brief This function returns whether leaves are evaluated with the MDP values.
+       *
+       * @return True for MDP values, False for random rollouts.
+       */
+      bool getLeafEvaluation() const;
+
+      /**
+       * @brief This function returns whether the root environments are stratified.
+       *
+       * @return True if the root environments are stratified.
+       */
+      bool getStratifiedRoot() const;
+
+      /**
+       * @brief This function returns the memory budget of the past-aware tree.
+       *
+       * @return The budget in bytes (0 for no limit).
+       */
+      size_t getMemoryBudget() const;
+
+      /**
+       * @brief This function returns the memory used by the search trees.
+       *
+       * This counts the nodes allocated in the trees (including
+       * particles) and the cached likelihoods. The pools may hold
+       * up to twice as much.
+       *
+       * @return The number of bytes.
+       */
+      size_t getMemoryUsage() const;
+
+      /**
+       * @brief This function returns the time budget per decision.
+       *
+       * @return The time budget in milliseconds (0 if the number of iterations is used).
+       */
+      double getTimeBudget() const;
+
+      /**
+       * @brief This function returns the confidence level of early stopping.
+       *
+       * @return The confidence level (0 if early stopping is disabled).
+       */
+      double getEarlyStop() const;
+
+      /**
+       * @brief This function returns the number of simulations allotted to the last decision.
+       *
+       * @return The budget of the last decision, in simulations.
+       */
+      unsigned getBudget() const;
+
+      /**
+       * @brief This function returns the confidence above which the environment is considered identified.
+       *
+       * @return The identification threshold (0 if disabled).
+       */
+      double getIdentifiedThreshold() const;
+
+      /**
+       * @brief This function returns the maximal number of simulations pondered between two decisions.
+       *
+       * @return The number of simulations (0 if pondering is disabled).
+       */
+      unsigned getPondering() const;
+
+      /**
+       * @brief This function returns the number of simulations run for the last action.
+       *
+       * @return The number of simulations, summed over all threads.
+       */
+      unsigned getSimulations() const;
+
+    private:
+      /**
+       * @brief An independent search tree grown by a root parallelization thread.
+       */
+      // With a shared tree, only the random engine is used.
+      struct Worker {
+	Worker(size_t base) : tree(base), rand(Impl::Seeder::getSeed()), valid(false) {}
+	Tree tree;
+	std::default_random_engine rand;
+	bool valid; // False if the tree must be restarted from the root belief
+      };
+
+      /**
+       * @brief A simulation descended in the tree, waiting for its rollout.
+       */
+      struct Descent {
+	struct Step {
+	  uint32_t node; // Belief node, whose stats may grow before the backup
+	  uint32_t a; // Index of the action in the stats
+	  double rew;
+	};
+	std::vector<Step> path; // Actions taken in the tree, from the root
+	size_t s; // Start state of the rollout
+	unsigned depth; // Start depth of the rollout, maxDepth_ if there is none
+	const EnvProb * belief; // Belief of the new node with MDP leaves, nullptr otherwise and with particles
+	std::vector<EnvProb> posterior; // Belief of a new node, with transpositions
+	double value; // Return of the rollout
+      };
+
+      /**
+       * @brief Buffers of the running rollouts of a batch, one entry per rollout.
+       */
+      struct Rollouts {
+	std::vector<size_t> lane, s, a, s2; // lane is the index of the descent in the batch
+	std::vector<unsigned> depth;
+	std::vector<double> r, value;
+      };
+
+      /**
+       * @brief Root statistics of an opening book entry, by action.
+       */
+      struct BookEntry {
+	BookEntry() : hits(0) {}
+	std::vector<double> V, N;
+	unsigned hits; // Decisions read from the entry
+      };
+
+      /**
+       * @brief A node of the hierarchy of environments: leaves are the E environments, then merges in order.
+       */
+      struct Cluster {
+	uint32_t left, right; // Merged clusters (NONE for an environment)
+	uint32_t medoid; // Environment simulated for the cluster
+      };
+
+      /**
+       * @brief Striped locks for node expansions in a shared tree. Copies get their own locks.
+       */
+      struct Locks {
+	Locks(size_t n = 0) : m(n) {}
+	Locks(const Locks & other) : m(other.m.size()) {}
+	Locks & operator=(const Locks & other) { m = std::vector<std::mutex>(other.m.size()); return *this; }
+	std::vector<std::mutex> m;
+      };
+
+      /**
+       * @brief The background thread of pondering, which is stopped on destruction. Copies start idle.
+       */
+      struct Ponder {
+	Ponder() : stop(false) {}
+	Ponder(const Ponder &) : stop(false) {}
+	Ponder & operator=(const Ponder &) { halt(); return *this; }
+	~Ponder() { halt(); }
+	void halt() { stop = true; if (thread.joinable()) thread.join(); }
+	std::thread thread;
+	std::atomic<bool> stop;
+	std::mutex m; // Held while a chunk of simulations runs
+      };
+
+      const M& model_;
+      size_t S, A, O, E, beliefSize_, treeBase_, memoryBudget_;
+      unsigned particleCap_;
+      unsigned iterations_, maxDepth_, threads_, rolloutBatch_;
+      double exploration_, virtualLoss_, timeBudget_;
+      bool sharedTree_;
+      bool mdpLeaves_;
+      std::vector<float> rolloutProb_; // Alias tables of the rollout policy, A entries per row
+      std::vector<uint32_t> rolloutAlias_;
+      size_t rolloutRows_; // O or S, 0 for uniform rollouts
+      bool stratifiedRoot_;
+      std::vector<float> rootProb_; // Alias table of the exact root belief
+      std::vector<uint32_t> rootAlias_;
+      double wideningC_, wideningAlpha_;
+      std::vector<Slot> orderIndex_; // Ranking of the actions of each observation in orders_, with progressive widening
+      NodePool<uint32_t> orders_; // Blocks of the A actions by decreasing prior, then of their A ranks
+      unsigned transpositionLevels_;
+      double supportThreshold_;
+      unsigned supportSize_;
+      std::vector<double> rootBelief_; // Exact belief of the root of graph_, with a belief support
+      std::vector<uint32_t> support_; // Sorted environments searched (empty for all)
+      double residual_; // Mass of rootBelief_ out of support_
+      double clusterThreshold_;
+      std::vector<Cluster> clusters_; // Hierarchy of the environments, the root last
+      Locks transpositionLock_; // Guards the table and the expansions of graph_ when the tree is shared
+      unsigned bookDepth_, bookLevels_, bookSimulations_, bookRefresh_;
+      std::unordered_map<uint64_t, BookEntry> book_;
+      unsigned sessionDepth_; // Decisions since the last root belief was given
+      bool booked_; // True if the last decision was read from the opening book
+      std::vector<double> leafValues_; // leafValues_[k * S + s] is the optimal value of s in its environment with k steps to go
+      double identifiedThreshold_;
+      std::vector<double> identifiedQ_; // identifiedQ_[s * A + a] is the MDP action value of a in s, for the identified policy
+      std::vector<uint32_t> identifiedPolicy_; // Best action of each state
+      size_t identifiedEnv_; // Environment of the last decision if it was played with its MDP policy, NONE otherwise
+      double stopDelta_;
+      unsigned stopInterval_;
+      const Stat * rootStats_; // Stats of the root of graph_ whose returns are tracked, with early stopping
+      std::vector<Stat> rootReturns_; // Sum, sum of squares and count of the returns of each root rank in the current search
+      Stat rootLow_, rootHigh_; // Range of these returns
+      double budgetFloor_;
+      unsigned sessionBudget_, sessionHorizon_, sessionSpent_, budget_;
+      double sumWeights_; // Sum of the weights of the decisions so far, with a budget schedule
+      unsigned nWeights_;
+      bool hasDeadline_; // True when deadline_ is set by a sampleAction call
+      Clock::time_point deadline_;
+      unsigned simulations_;
+
+      Tree graph_;
+      uint32_t fullroot_; // Root of the past-aware tree in graph_
+      size_t detachedBytes_; // Bytes of graph_ in detached trees, without a memory budget
+      size_t detachedFrom_; // Bytes of graph_ when the current detached tree started, 0 if there is none
+      Tree scratch_; // Destination of compact()
+      std::vector<uint32_t> linkStart_; // Links of o are links_[linkStart_[o]:linkStart_[o+1]]
+      std::vector<uint32_t> links_; // Sorted successor observations
+      std::vector<Slot> likelihoodIndex_; // Likelihoods of (obs, a, link) in likelihoods_, at (linkStart_[obs] + link) * A + a
+      NodePool<double> likelihoods_; // Blocks of E likelihoods P_e(o | obs, a)
+      bool with_tree;
+      bool with_exact_belief;
+
+      mutable std::default_random_engine rand_;
+      std::vector<double> logTable_; // logTable_[n] = log(n + 1)
+      std::vector<Worker> workers_;
+      Locks locks_;
+      unsigned ponderSimulations_;
+      unsigned ponderCredit_; // Simulations pondered in the current root, deducted from the next search
+      std::vector<unsigned> ponderBase_; // Visits of the children of the root, by rank and link, when pondering started
+      std::default_random_engine ponderRand_;
+      mutable Ponder ponder_; // Last, so that pondering stops before the other members are destroyed
+
+      /**
+       * @brief This function starts the simulation process.
+       *
+       * This function simply runs simulations for the number of
+       * times specified by POMCP's parameters. While doing so it
+       * builds a tree of explored outcomes, from which POMCP will
+       * then extract the best expected action for the current
+       * belief.
+       *
+       * @param horizon The horizon for which to plan.
+       *
+       * @return The best action to take given the final built tree.
+       */
+      size_t runSimulation(unsigned horizon);
+
+      /**
+       * @brief This function starts pondering from the root of graph_, if enabled.
+       */
+      void startPondering();
+
+      /**
+       * @brief This function stops pondering and waits for the background thread.
+       */
+      void stopPondering();
+
+      /**
+       * @brief This function runs pondered simulations from a child of the root of graph_.
+       *
+       * The child is created if needed. Its environments are sampled
+       * from its own belief, and the simulations run to the remaining
+       * horizon of the root minus one.
+       *
+       * @param r The rank of the action at the root.
+       * @param l The link of the observation at the root.
+       * @param n The number of simulations to run.
+       *
+       * @return The number of simulations run.
+       */
+      unsigned ponderChild(size_t r, uint32_t l, unsigned n);
+
+      /**
+       * @brief This function returns the number of pondered simulations that went through a child of the root.
+       *
+       * @param a The action.
+       * @param o The observation.
+       *
+       * @return The visits gained by the child since pondering started.
+       */
+      unsigned ponderedVisits(size_t a, size_t o);
+
+      /**
+       * @brief This function reads the decision at the root of graph_ from the opening book.
+       *
+       * @param key The book key of the root.
+       *
+       * @return True if the root statistics were read from the book.
+       */
+      bool readBook(uint64_t key);
+
+      /**
+       * @brief This function stores the root statistics of graph_ in the opening book.
+       *
+       * @param key The book key of the root.
+       */
+      void writeBook(uint64_t key);
+
+      /**
+       * @brief This function returns the opening book key of the root of graph_.
+       */
+      uint64_t bookKey() const;
+
+      /**
+       * @brief This function returns the number of root simulations of an opening book entry (0 if missing).
+       *
+       * @param key The book key.
+       */
+      double bookVisits(uint64_t key) const;
+
+      /**
+       * @brief This function computes the belief over environments after an (action, observation) pair from a node of graph_.
+       *
+       * The exact belief of the node, or the histogram of its
+       * particles, is updated with the likelihood of the transition.
+       *
+       * @param b The belief node.
+       * @param a The action.
+       * @param o The observation.
+       * @param posterior The posterior belief.
+       *
+       * @return False if o has probability 0 from the belief of b.
+       */
+      bool posteriorOf(uint32_t b, size_t a, size_t o, Belief & posterior);
+
+      /**
+       * @brief This function adds the child of a belief node for an (action, observation) pair.
+       *
+       * @param t The tree.
+       * @param b The belief node, which is expanded.
+       * @param a The action.
+       * @param o The observation.
+       *
+       * @return The slot of the child, or nullptr if o cannot follow the observation of b.
+       */
+      Slot * addChild(Tree & t, uint32_t b, size_t a, size_t o);
+
+      /**
+       * @brief This function runs a given number of simulations from the root of a tree.
+       *
+       * With a deadline, simulations are run until the deadline
+       * instead. The clock is checked every DEADLINE_CHECK simulations.
+       *
+       * @param t The tree to grow.
+       * @param n The number of simulations to run.
+       * @param rng The random engine to use.
+       * @param deadline The deadline, or nullptr to run n simulations.
+       * @param early If True, stop once the best root action of graph_ is separated (see setEarlyStop).
+       *
+       * @return The number of simulations run.
+       */
+      unsigned runIterations(Tree & t, unsigned n, std::default_random_engine & rng, const Clock::time_point * deadline, bool early = false);
+
+      /**
+       * @brief This function returns whether the best root action of graph_ is separated from the others in the current search.
+       */
+      bool separated() const;
+
+      /**
+       * @brief This function returns the number of simulations of the next decision (see setBudgetSchedule).
+       *
+       * @param horizon The horizon of the decision.
+       */
+      unsigned stepBudget(unsigned horizon);
+
+      /**
+       * @brief This function returns the entropy of the root environment belief of graph_, divided by log(E).
+       */
+      double rootEntropy() const;
+
+      // Number of simulations between two reads of the clock
+      static constexpr unsigned DEADLINE_CHECK = 16;
+
+      /**
+       * @brief The number of simulations pondered between two checks of the stop flag.
+       */
+      static constexpr unsigned PONDER_CHUNK = 64;
+
+      /**
+       * @brief This function merges the root action statistics of all
+       * the workers' trees into graph_.
+       */
+      void mergeRoots();
+
+      /**
+       * @brief This function returns the lock guarding the expansion of a node when the tree is shared.
+       *
+       * Locks are striped: several nodes may share the same lock.
+       *
+       * @param node The address of the node.
+       *
+       * @return The corresponding mutex.
+       */
+      std::mutex & nodeLock(const void * node);
+
+      /**
+       * @brief This function backs up a simulation return into the stats of an action.
+       *
+       * @param stats The stats of the belief node.
+       * @param ranks The number of actions of the stats.
+       * @param a The action.
+       * @param rew The discounted return of the simulation.
+       */
+      void updateAction(Stat * stats, size_t ranks, size_t a, double rew);
+
+      /**
+       * @brief This function atomically adds a value to a double.
+       *
+       * @return The new value.
+       */
+      static double atomicAdd(std::atomic<double> & x, double d);
+
+      /**
+       * @brief This function simulates the model from a belief node down to a leaf of the tree.
+       *
+       * From the given belief node and state, this function selects
+       * an action based on UCT (so that estimated good actions are
+       * taken more often than estimated bad actions) and samples a
+       * new state, observation and reward. Based on the observation,
+       * the function detects whether it is at the end of the tree or
+       * not. If it is, it adds a new node to the tree, whose value
+       * is estimated by a rollout of the rest of the episode (see
+       * rollouts()). Otherwise it traverses the tree.
+       *
+       * The states obtained on the way are used to update particle
+       * beliefs within the tree. Exact beliefs are only computed
+       * when a node is first descended into, from the belief of its
+       * parent (see materialize()). The actions and rewards are
+       * recorded in the descent, to back up the return of the
+       * simulation once the rollout is done.
+       *
+       * @param t The tree being grown.
+       * @param b The tree node to simulate from.
+       * @param s The state from which we are simulating, possibly a particle of a previous particle belief.
+       * @param rng The random engine to use.
+       * @param d The descent to record the simulation in.
+       * @param start The depth of b below the root of the search.
+       */
+      void descend(Tree & t, uint32_t b, size_t s, std::default_random_engine & rng, Descent & d, unsigned start = 0);
+
+      /**
+       * @brief This function implements the rollout policy for POMCP on a batch of simulations.
+       *
+       * This function extracts some cumulative reward from a
+       * particular state, given that we have reached a particular
+       * horizon. The idea behind this function is to approximate the
+       * true value of the state; since this function is called when
+       * we are at the leaves of our tree, the only way for us to
+       * extract more information is to simply simulate the rest of
+       * the episode directly.
+       *
+       * However, in order to speed up the process and store only
+       * useful data, we avoid inserting every single state that we
+       * see here into the tree, preferring to add a single state at
+       * a time. This avoids wasting lots of computation and memory
+       * on states far from our root that we will probably never see
+       * again, while at the same time still getting an estimate for
+       * the rest of the simulation.
+       *
+       * The rollouts of the batch advance in lockstep: at each step,
+       * the random actions of all the running rollouts are drawn,
+       * then the model samples all their transitions at once.
+       *
+       * With MDP leaf evaluation, the return is read from the
+       * precomputed values instead (see setLeafEvaluation).
+       *
+       * @param batch The descents, whose value is set to the rollout return.
+       * @param n The number of descents.
+       * @param rng The random engine to use.
+       * @param buf The buffers of the running rollouts.
+       */
+      void rollouts(Descent * batch, size_t n, std::default_random_engine & rng, Rollouts & buf);
+
+      /**
+       * @brief This function samples the action of a rollout at a given state.
+       *
+       * @param s The state.
+       * @param rng The random engine to use.
+       *
+       * @return The action.
+       */
+      size_t rolloutAction(size_t s, std::default_random_engine & rng) const;
+
+      /**
+       * @brief This function builds the alias table of a distribution with Vose's method.
+       *
+       * @param w The n weights, all 0 for the uniform distribution.
+       * @param n The number of outcomes.
+       * @param prob The n probabilities of keeping an outcome.
+       * @param alias The n alternative outcomes.
+       */
+      template <typename W>
+      void buildAlias(const W * w, size_t n, float * prob, uint32_t * alias) const;
+
+      /**
+       * @brief This function draws the stratified environments of n simulations from a belief.
+       *
+       * @param belief The belief over environments.
+       * @param n The number of simulations.
+       * @param rng The random engine to use.
+       * @param strata The environments, in a random order.
+       */
+      void stratify(const EnvProb * belief, unsigned n, std::default_random_engine & rng, std::vector<uint32_t> & strata) const;
+
+      /**
+       * @brief This function samples an alias table in O(1).
+       *
+       * @return The outcome.
+       */
+      size_t sampleAlias(const float * prob, const uint32_t * alias, size_t n, std::default_random_engine & rng) const;
+
+      /**
+       * @brief This function solves the MDP of each environment up to a given horizon.
+       *
+       * The values of the horizons already solved are kept.
+       *
+       * @param horizon The largest number of steps to go.
+       */
+      void solveLeafValues(unsigned horizon);
+
+      /**
+       * @brief This function returns the MDP action value of a state.
+       *
+       * @param s The state.
+       * @param a The action.
+       * @param successors The states reachable from s.
+       * @param next The optimal values with one step less to go.
+       */
+      double mdpQValue(size_t s, size_t a, const std::vector<size_t> & successors, const double * next) const;
+
+      /**
+       * @brief This function returns the environment holding more than identifiedThreshold_ of the root belief of graph_, or NONE.
+       */
+      size_t identifiedEnvironment() const;
+
+      /**
+       * @brief This function returns the MDP value of the start of a rollout.
+       *
+       * @param d The descent.
+       *
+       * @return The expected optimal return of the remaining steps.
+       */
+      double leafValue(const Descent & d) const;
+
+      /**
+       * @brief This function backs up the return of a simulation in the stats along its path.
+       *
+       * @param t The tree of the descent.
+       * @param d The descent, with the return of its rollout.
+       */
+      void backup(Tree & t, const Descent & d);
+
+      /**
+       * @brief This function returns whether pending simulations are counted as a virtual loss.
+       */
+      bool pendingLoss() const;
+
+
+      /**
+       * @brief This function finds the best action based on value.
+       *
+       * @param stats The stats of a belief node.
+       *
+       * @return The action with the best value.
+       */
+      size_t findBestA(const Stat * stats) const;
+
+      /**
+       * @brief This function returns the number of actions considered by UCT in a node.
+       *
+       * @param n The visit count of the node.
+       *
+       * @return The number of actions, by rank.
+       */
+      size_t width(unsigned n) const;
+
+      /**
+       * @brief This function ranks the actions of an observation for progressive widening.
+       *
+       * The ranking is computed the first time it is needed, then cached.
+       *
+       * @param obs The observation.
+       */
+      void rankActions(size_t obs);
+
+      /**
+       * @brief This function returns the action of a stats index of a node.
+       *
+       * @param obs The observation of the node, whose actions are ranked.
+       * @param r The index in the stats.
+       *
+       * @return The action.
+       */
+      size_t actionOf(size_t obs, size_t r) const;
+
+      /**
+       * @brief This function returns the stats index of an action of a node.
+       *
+       * @param obs The observation of the node, whose actions are ranked.
+       * @param a The action.
+       *
+       * @return The index in the stats.
+       */
+      size_t rankOf(size_t obs, size_t a) const;
+
+      /**
+       * @brief This function finds the best action based on UCT.
+       *
+       * UCT gives a bonus to actions that have been tried very few
+       * times, in order to void thinking that a bad action is bad
+       * just because it got unlucky the few times that it tried it.
+       * Actions never tried get an infinite score.
+       *
+       * Scores are computed 4 (AVX2) or 8 (AVX-512) actions at a
+       * time when the compiler targets these instruction sets.
+       *
+       * @param stats The stats of a belief node.
+       * @param ranks The number of actions of the stats.
+       * @param count The sum of all action counts.
+       * @param width The number of actions to consider.
+       *
+       * @return The action to be selected based on UCT.
+       */
+      size_t findBestBonusA(const Stat * stats, size_t ranks, unsigned count, size_t width) const;
+
+      /**
+       * @brief This function fills the table of log(n + 1) used by UCT.
+       */
+      void computeLogTable();
+
+      /**
+       * @brief This function samples a given belief in order to produce a particle approximation of it.
+       *
+       * @param b The belief (over environment) to be approximated.
+       *
+       * @return A particle belief approximating the input belief.
+       */
+      SampleBelief makeSampledBelief(const Belief & b);
+
+      /**
+       * @brief This function returns the link of an observation from its parent observation.
+       *
+       * @param obs The parent observation.
+       * @param o The child observation.
+       *
+       * @return The index of o among the links of obs, or NONE if o is not reachable from obs.
+       */
+      uint32_t linkOf(size_t obs, size_t o) const;
+
+      /**
+       * @brief This function returns the number of links (successor observations) of an observation.
+       */
+      size_t nLinks(size_t obs) const;
+
+      /**
+       * @brief This function returns the states of the links of a state, in its environment.
+       *
+       * They include every successor of the state, and possibly states it never reaches.
+       */
+      std::vector<size_t> successorStates(size_t s) const;
+
+      /**
+       * @brief This function returns the likelihood of an observation in each environment.
+       *
+       * The likelihoods of a transition are computed from the model
+       * the first time they are needed, then cached.
+       *
+       * @param obs The parent observation.
+       * @param a The action.
+       * @param link The link of o from obs.
+       * @param o The observation.
+       *
+       * @return The E probabilities P_e(o | obs, a).
+       */
+      const double * likelihood(size_t obs, size_t a, uint32_t link, size_t o);
+
+      /**
+       * @brief This function computes the normalized product of a belief and a likelihood.
+       *
+       * The product and the normalization are computed 4 (AVX2) or 8
+       * (AVX-512) environments at a time when the compiler targets
+       * these instruction sets. Float beliefs use the scalar loop.
+       *
+       * With a belief support, only its environments are written:
+       * the posterior must be zero elsewhere.
+       *
+       * @param prior The belief over environments.
+       * @param likelihood The likelihood of each environment.
+       * @param posterior The output belief.
+       */
+      void updateBelief(const EnvProb * prior, const double * likelihood, EnvProb * posterior) const;
+
+      /**
+       * @brief This function sets the support from rootBelief_ and writes the restricted belief in the root of graph_.
+       */
+      void restrictRoot();
+
+      /**
+       * @brief This function returns whether searches run on a restricted support of the exact root belief.
+       */
+      bool restricted() const;
+
+      /**
+       * @brief This function returns the exact belief of the root in an environment.
+       *
+       * A restricted root only holds its support, with the mass of
+       * the clusters on their medoids: the reported belief is the
+       * unrestricted one.
+       *
+       * @param e The environment.
+       */
+      double rootProbability(size_t e) const;
+
+      /**
+       * @brief This function builds clusters_ from the transitions of the environments.
+       */
+      void buildClusters();
+
+      /**
+       * @brief This function computes the exact belief of a node if it does not have one yet.
+       *
+       * Beliefs are not computed when nodes are created, since most
+       * nodes are leaves that are never descended into. The
+       * posterior is computed from the belief of the parent and the
+       * cached likelihood of the transition.
+       *
+       * The belief is always stored densely, E entries per node, even
+       * when the support of setBeliefSupport leaves most of them at
+       * zero: sparse node beliefs are not implemented.
+       *
+       * @param t The tree containing the nodes.
+       * @param parent The parent belief node, which has a belief.
+       * @param a The action leading to the node.
+       * @param b The belief node.
+       */
+      void materialize(Tree & t, uint32_t parent, size_t a, uint32_t b);
+
+      /**
+       * @brief This function returns the key of a belief in the transposition table or the opening book.
+       *
+       * @param o The observation of the node (and any other value to key on).
+       * @param belief The belief of the node.
+       * @param levels The number of quantization levels of a belief entry.
+       *
+       * @return A hash of the observation and the quantized belief.
+       */
+      uint64_t beliefKey(size_t o, const EnvProb * belief, unsigned levels) const;
+
+      /**
+       * @brief This function finds or creates the node reached from a belief node through the transposition table.
+       *
+       * @param t The tree.
+       * @param b The parent belief node.
+       * @param a The action.
+       * @param link The link of o from the observation of b.
+       * @param o The observation.
+       * @param togo The remaining horizon of the node.
+       * @param posterior A buffer for the belief of the node.
+       * @param created Set to whether the node was created.
+       *
+       * @return The index of the node.
+       */
+      uint32_t transpose(Tree & t, uint32_t b, size_t a, uint32_t link, size_t o, unsigned togo, std::vector<EnvProb> & posterior, bool & created);
+
+      /**
+       * @brief This function returns whether an entry of the transposition table has a given remaining horizon, observation and quantized belief.
+       *
+       * @param t The tree.
+       * @param entry The entry.
+       * @param o The observation.
+       * @param togo The remaining horizon.
+       * @param belief The belief, quantized as in beliefKey.
+       */
+      bool sameKey(const Tree & t, const Transposition & entry, size_t o, unsigned togo, const EnvProb * belief) const;
+
+      /**
+       * @brief This function allocates a belief node with no belief and no children.
+       *
+       * @param t The tree to allocate in.
+       * @param o The observation of the node.
+       *
+       * @return The index of the new node.
+       */
+      uint32_t newBeliefNode(Tree & t, size_t o);
+
+      /**
+       * @brief This function allocates the action nodes of the first ranked actions of a belief node if needed.
+       *
+       * With progressive widening, a node only gets the stats and
+       * slots of the actions UCT may select: they are moved to a
+       * block twice as large when its width exceeds them. With a
+       * shared tree, other threads update the stats without locks,
+       * so nodes get all the actions at once.
+       *
+       * @param t The tree containing the node.
+       * @param b The belief node.
+       * @param n The number of ranked actions needed.
+       */
+      void expand(Tree & t, uint32_t b, size_t n);
+
+      /**
+       * @brief This function returns the child slot of a belief node for an (action, observation) pair.
+       *
+       * @param t The tree containing the node.
+       * @param b The belief node.
+       * @param a The action.
+       * @param o The observation.
+       *
+       * @return The slot, or nullptr if it was never allocated.
+       */
+      Slot * findSlot(Tree & t, uint32_t b, size_t a, size_t o);
+
+      /**
+       * @brief This function copies the observation and belief of a node in another tree.
+       *
+       * @return The index of the copy in the destination tree.
+       */
+      uint32_t copyBeliefNode(const Tree & from, uint32_t b, Tree & to);
+
+      /**
+       * @brief This function copies a subtree in another tree.
+       *
+       * With transpositions, the subtree is a graph: the nodes
+       * already copied are found in copies, and the transposition
+       * table of the destination is filled.
+       *
+       * @param from The source tree.
+       * @param b The root of the subtree.
+       * @param to The destination tree.
+       * @param minN The children visited less than minN times are not copied.
+       *
+       * @return The index of the copied root in the destination tree.
+       */
+      uint32_t copySubtree(const Tree & from, uint32_t b, Tree & to, unsigned minN = 0);
+
+      /**
+       * @brief This function copies a subtree, recording the copy of each node.
+       *
+       * @param copies The index of the copy of each node of from, NONE if not copied yet.
+       */
+      uint32_t copyNodes(const Tree & from, uint32_t b, Tree & to, unsigned minN, std::vector<uint32_t> & copies);
+
+      /**
+       * @brief This function returns the memory used by the nodes of a tree.
+       */
+      size_t treeBytes(const Tree & t) const;
+
+      /**
+       * @brief This function lists the nodes of a subtree with their visit count and size.
+       *
+       * @param b The root of the subtree in graph_.
+       * @param nodes The list to append to.
+       * @param listed Whether each node of graph_ is already listed, with transpositions.
+       */
+      void listNodes(uint32_t b, std::vector<std::pair<unsigned, size_t> > & nodes, std::vector<bool> & listed) const;
+
+      /**
+       * @brief This function prunes the past-aware tree down to the memory budget.
+       *
+       * The nodes visited at least a threshold number of times are
+       * copied to a fresh arena; since a child is never visited more
+       * than its parent, they form a subtree rooted at fullroot_.
+       * Branches detached from the past-aware tree are dropped too.
+       */
+      void prune();
+
+      /**
+       * @brief This function drops the detached trees of the failures from graph_ once they hold a quarter of it, without a memory budget.
+       */
+      void dropDetached();
+
+      /**
+       * @brief This function makes a node the root of its tree and frees the rest of the tree.
+       *
+       * The subtree is moved to a fresh arena, which is swapped with the tree.
+       *
+       * @param t The tree.
+       * @param b The new root.
+       */
+      void compact(Tree & t, uint32_t b);
+    };
+
+    template <typename M>
+    constexpr uint32_t PAMCP<M>::NONE;
+
+    template <typename M>
+    constexpr unsigned PAMCP<M>::DEADLINE_CHECK;
+
+    template <typename M>
+    constexpr unsigned PAMCP<M>::PONDER_CHUNK;
+
+    template <typename M>
+    PAMCP<M>::PAMCP(const M& m, size_t beliefSize, unsigned iter, double exp, bool with_tree_/*=false*/, bool with_exact_belief_/*=true*/) : model_(m), S(model_.getS()), A(model_.getA()), O(model_.getO()), E(model_.getE()), beliefSize_(beliefSize), memoryBudget_(0), particleCap_(0), iterations_(iter), threads_(1), rolloutBatch_(1), exploration_(exp), virtualLoss_(1.0), timeBudget_(0.0), sharedTree_(false), mdpLeaves_(false), rolloutRows_(0), stratifiedRoot_(false), wideningC_(0.0), wideningAlpha_(0.5), transpositionLevels_(0), supportThreshold_(0.0), supportSize_(0), residual_(0.0), clusterThreshold_(0.0), transpositionLock_(1), bookDepth_(0), bookLevels_(100), bookSimulations_(0), bookRefresh_(0), sessionDepth_(0), booked_(false), identifiedThreshold_(0.0), identifiedEnv_(NONE), stopDelta_(0.0), stopInterval_(100), rootStats_(nullptr), budgetFloor_(1.0), sessionBudget_(0), sessionHorizon_(0), sessionSpent_(0), budget_(0), sumWeights_(0.0), nWeights_(0), hasDeadline_(false), simulations_(0), with_tree(with_tree_), with_exact_belief(with_exact_belief_), rand_(Impl::Seeder::getSeed()), ponderSimulations_(0), ponderCredit_(0), ponderRand_(Impl::Seeder::getSeed()) {
+      // Links of each observation: its successors in any environment.
+      // Some models list fewer successors than their transition rows
+      // have (e.g. the goal states of the mazes), so the observations
+      // listing o among their predecessors are added.
+      std::vector<std::vector<uint32_t>> next(O);
+      for (size_t e = 0; e < E; ++e) {
+	for (size_t o = 0; o < O; ++o) {
+	  for (auto s : model_.reachable_states(e * O + o)) next[o].push_back(model_.get_rep(s));
+	  for (auto s : model_.previous_states(e * O + o)) next[model_.get_rep(s)].push_back(o);
+	}
+      }
+      size_t maxLinks = 0;
+      linkStart_.resize(O + 1);
+      for (size_t o = 0; o < O; ++o) {
+	std::vector<uint32_t> & successors = next[o];
+	std::sort(successors.begin(), successors.end());
+	successors.erase(std::unique(successors.begin(), successors.end()), successors.end());
+	linkStart_.at(o) = links_.size();
+	links_.insert(links_.end(), successors.begin(), successors.end());
+	maxLinks = std::max(maxLinks, successors.size());
+      }
+      linkStart_.at(O) = links_.size();
+      likelihoodIndex_.resize(links_.size() * A);
+
+      // Blocks of 3A stats, E belief entries or maxLinks slots must fit in a chunk
+      treeBase_ = std::max<size_t>({1024, 3 * A, E, maxLinks});
+      graph_ = Tree(treeBase_);
+      likelihoods_ = NodePool<double>(treeBase_);
+      orders_ = NodePool<uint32_t>(treeBase_);
+      fullroot_ = NONE;
+      detachedBytes_ = 0;
+      detachedFrom_ = 0;
+      scratch_ = Tree(treeBase_);
+      computeLogTable();
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::sampleAction(const Belief& be, size_t o, unsigned horizon, bool start_session /* false */) {
+      stopPondering();
+      ponderBase_.clear();
+      ponderCredit_ = 0;
+      if (with_tree && start_session && memoryBudget_ && fullroot_ != NONE) prune();
+      if (with_tree && !memoryBudget_ && fullroot_ != NONE) dropDetached();
+      if (start_session) {
+	sessionDepth_ = 0;
+	sessionHorizon_ = horizon;
+	sessionSpent_ = 0;
+      }
+
+      // Restart from the stored information
+      if (with_tree && start_session && fullroot_ != NONE && graph_.beliefs[fullroot_].obs == o) {
+	graph_.root = fullroot_;
+      }
+      // Reset graph initially or with new belief (e.g. observation missing)
+      else {
+	// The past-aware tree is kept, failures start a detached tree.
+	// Without a memory budget, the old tree is dropped when a
+	// session starts from another observation.
+	if (!with_tree) graph_.clear();
+	else if (start_session && !memoryBudget_ && fullroot_ != NONE) {
+	  graph_.clear();
+	  detachedBytes_ = 0;
+	}
+	if (with_tree && !start_session && !memoryBudget_) detachedFrom_ = graph_.used();
+	graph_.root = newBeliefNode(graph_, o);
+	if (with_tree && start_session) fullroot_ = graph_.root;
+      }
+      expand(graph_, graph_.root, A);
+
+      // Init the env belief
+      auto & root = graph_.beliefs[graph_.root];
+      if (with_exact_belief) {
+	if (root.envbelief == NONE) root.envbelief = graph_.envbeliefs.allocate(E);
+	EnvProb * envbelief = &graph_.envbeliefs[root.envbelief];
+	for (size_t i = 0; i < E; i++) {
+	  envbelief[i] = be(i);
+	}
+	if (restricted()) {
+	  rootBelief_.assign(envbelief, envbelief + E);
+	  restrictRoot();
+	}
+      } else {
+	root.smplbelief = makeSampledBelief(be);
+      }
+
+      // Workers restart from the new root belief
+      for (auto & w : workers_) w.valid = false;
+
+      return runSimulation(horizon);
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::sampleAction(size_t a, size_t o, unsigned horizon) {
+      ++sessionDepth_;
+      stopPondering();
+      ponderCredit_ = ponderedVisits(a, o);
+      // An observation never reached in simulation (or a decision read
+      // from the opening book) gets a new node, whose belief is the
+      // posterior of the root: exact beliefs are materialized as
+      // usual, particles are drawn from it below.
+      Belief posterior;
+      // The exact belief follows the observation over all the environments
+      double exact = 0.0;
+      if (with_exact_belief && restricted()) {
+	auto & node = graph_.beliefs[graph_.root];
+	uint32_t link = linkOf(node.obs, o);
+	const double * lik = (link != NONE ? likelihood(node.obs, a, link, o) : nullptr);
+	for (size_t e = 0; lik && e < E; ++e) exact += rootBelief_[e] * lik[e];
+	if (exact > 0.0)
+	  for (size_t e = 0; e < E; ++e) rootBelief_[e] *= lik[e] / exact;
+      }
+      Slot * slot = findSlot(graph_, graph_.root, a, o);
+      if ( !slot || slot->node == NONE || (!with_exact_belief && !graph_.beliefs[slot->node].smplbelief.size()) ) {
+	if ( !posteriorOf(graph_.root, a, o, posterior) ) {
+	  // The observation may only be explained by environments out of the support
+	  if (exact > 0.0) {
+	    auto b = Belief(E);
+	    for (size_t e = 0; e < E; ++e) b(e) = rootBelief_[e];
+	    return sampleAction(b, o, horizon, false);
+	  }
+	  std::cerr << "\nObservation " << o << " impossible from the current belief, restarting belief from " << o << "\n";
+	  auto b = Belief(E); b.fill(1.0 / E);
+	  return sampleAction(b, o, horizon, false);
+	}
+	slot = addChild(graph_, graph_.root, a, o);
+      }
+
+      // The new root gets its belief before the old one is dropped.
+      // The past-aware tree keeps every branch, otherwise the rest of the tree is dropped.
+      materialize(graph_, graph_.root, a, slot->node);
+      if (with_tree)
+	graph_.root = slot->node;
+      else
+	compact(graph_, slot->node);
+      if (with_exact_belief && restricted()) restrictRoot();
+
+      // Each worker carries forward its own subtree for (a, o) if it has one.
+      // In sampled mode, the particles reaching o in all trees are merged at the root.
+      for (auto & w : workers_) {
+	if (!w.valid) continue;
+	Slot * wslot = findSlot(w.tree, w.tree.root, a, o);
+	if ( !wslot || wslot->node == NONE || (!with_exact_belief && !w.tree.beliefs[wslot->node].smplbelief.size()) ) {
+	  w.valid = false;
+	  continue;
+	}
+	materialize(w.tree, w.tree.root, a, wslot->node);
+	compact(w.tree, wslot->node);
+	expand(w.tree, w.tree.root, A);
+	if (!with_exact_belief) {
+	  auto & particles = w.tree.beliefs[w.tree.root].smplbelief;
+	  graph_.beliefs[graph_.root].smplbelief.merge(particles, E);
+	}
+      }
+
+      // Particles are reinvigorated from the posterior when none reached the new root
+      auto & root = graph_.beliefs[graph_.root];
+      if ( !with_exact_belief && !root.smplbelief.size() ) root.smplbelief = makeSampledBelief(posterior);
+
+      // We expand here in case we didn't have time to sample the new
+      // head node. In this case, the new head may not have children.
+      // This would break the UCT call.
+      expand(graph_, graph_.root, A);
+
+      return runSimulation(horizon);
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::sampleAction(const Belief& be, size_t o, unsigned horizon, Clock::time_point deadline, bool start_session /* false */) {
+      hasDeadline_ = true;
+      deadline_ = deadline;
+      size_t a = sampleAction(be, o, horizon, start_session);
+      hasDeadline_ = false;
+      return a;
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::sampleAction(size_t a, size_t o, unsigned horizon, Clock::time_point deadline) {
+      hasDeadline_ = true;
+      deadline_ = deadline;
+      size_t best = sampleAction(a, o, horizon);
+      hasDeadline_ = false;
+      return best;
+    }
+
+    template <typename M>
+    uint32_t PAMCP<M>::linkOf(size_t obs, size_t o) const {
+      auto begin = links_.begin() + linkStart_[obs], end = links_.begin() + linkStart_[obs + 1];
+      auto it = std::lower_bound(begin, end, o);
+      return (it != end && *it == o) ? std::distance(begin, it) : NONE;
+    }
+
+    template <typename M>
+    std::vector<size_t> PAMCP<M>::successorStates(size_t s) const {
+      size_t obs = model_.get_rep(s), base = s - obs;
+      std::vector<size_t> successors;
+      successors.reserve(nLinks(obs));
+      for (uint32_t i = linkStart_[obs]; i < linkStart_[obs + 1]; ++i) successors.push_back(base + links_[i]);
+      return successors;
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::nLinks(size_t obs) const {
+      return linkStart_[obs + 1] - linkStart_[obs];
+    }
+
+    template <typename M>
+    const double * PAMCP<M>::likelihood(size_t obs, size_t a, uint32_t link, size_t o) {
+      auto & entry = likelihoodIndex_[(linkStart_[obs] + link) * A + a].node;
+      uint32_t l = entry.load(std::memory_order_acquire);
+      if (l == NONE) {
+	uint32_t fresh = likelihoods_.allocate(E);
+	double * lik = &likelihoods_[fresh];
+	for (size_t e = 0; e < E; ++e) {
+	  lik[e] = model_.getTransitionProbability(e * O + obs, a, e * O + o);
+	}
+	// With a shared tree, another thread may have filled the entry meanwhile: its block is used
+	if (entry.compare_exchange_strong(l, fresh, std::memory_order_acq_rel)) l = fresh;
+      }
+      return &likelihoods_[l];
+    }
+
+    template <typename M>
+    void PAMCP<M>::updateBelief(const EnvProb * prior, const double * likelihood, EnvProb * posterior) const {
+      if (!support_.empty()) {
+	double nrm = 0.0;
+	for (auto e : support_) nrm += (posterior[e] = prior[e] * likelihood[e]);
+	// A node of an older search may miss an environment added to the support since
+	if (nrm <= 0.0)
+	  for (auto e : support_) nrm += (posterior[e] = likelihood[e]);
+	for (auto e : support_) posterior[e] /= nrm;
+	return;
+      }
+      size_t i = 0;
+      double nrm = 0.0;
+#if defined(__AVX512F__) && !defined(PAMCP_FLOAT_BELIEFS)
+      __m512d sum = _mm512_setzero_pd();
+      for ( ; i + 8 <= E; i += 8 ) {
+	__m512d p = _mm512_mul_pd(_mm512_loadu_pd(prior + i), _mm512_loadu_pd(likelihood + i));
+	_mm512_storeu_pd(posterior + i, p);
+	sum = _mm512_add_pd(sum, p);
+      }
+      double lanes[8];
+      _mm512_storeu_pd(lanes, sum);
+      nrm = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+#elif defined(__AVX2__) && !defined(PAMCP_FLOAT_BELIEFS)
+      __m256d sum = _mm256_setzero_pd();
+      for ( ; i + 4 <= E; i += 4 ) {
+	__m256d p = _mm256_mul_pd(_mm256_loadu_pd(prior + i), _mm256_loadu_pd(likelihood + i));
+	_mm256_storeu_pd(posterior + i, p);
+	sum = _mm256_add_pd(sum, p);
+      }
+      double lanes[4];
+      _mm256_storeu_pd(lanes, sum);
+      nrm = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+      for ( ; i < E; ++i ) {
+	posterior[i] = prior[i] * likelihood[i];
+	nrm += posterior[i];
+      }
+
+      i = 0;
+#if defined(__AVX512F__) && !defined(PAMCP_FLOAT_BELIEFS)
+      const __m512d n8 = _mm512_set1_pd(nrm);
+      for ( ; i + 8 <= E; i += 8 )
+	_mm512_storeu_pd(posterior + i, _mm512_div_pd(_mm512_loadu_pd(posterior + i), n8));
+#elif defined(__AVX2__) && !defined(PAMCP_FLOAT_BELIEFS)
+      const __m256d n4 = _mm256_set1_pd(nrm);
+      for ( ; i + 4 <= E; i += 4 )
+	_mm256_storeu_pd(posterior + i, _mm256_div_pd(_mm256_loadu_pd(posterior + i), n4));
+#endif
+      for ( ; i < E; ++i ) {
+	posterior[i] /= nrm;
+      }
+    }
+
+    template <typename M>
+    void PAMCP<M>::restrictRoot() {
+      // The candidates are the environments, or the medoids of the clusters of the cut
+      std::vector<double> candidates(rootBelief_);
+      if (clusterThreshold_ > 0 && !clusters_.empty()) {
+	std::vector<double> mass(clusters_.size());
+	std::copy(rootBelief_.begin(), rootBelief_.end(), mass.begin());
+	for (size_t c = E; c < clusters_.size(); ++c) mass[c] = mass[clusters_[c].left] + mass[clusters_[c].right];
+	std::fill(candidates.begin(), candidates.end(), 0.0);
+	std::vector<uint32_t> stack(1, clusters_.size() - 1);
+	while (!stack.empty()) {
+	  uint32_t c = stack.back();
+	  stack.pop_back();
+	  if (mass[c] > clusterThreshold_ && clusters_[c].left != NONE) {
+	    stack.push_back(clusters_[c].left);
+	    stack.push_back(clusters_[c].right);
+	  } else {
+	    candidates[clusters_[c].medoid] = mass[c];
+	  }
+	}
+      }
+
+      std::vector<uint32_t> order(E);
+      std::iota(order.begin(), order.end(), 0);
+      auto likelier = [&candidates](uint32_t x, uint32_t y) { return candidates[x] > candidates[y]; };
+      size_t k = (supportSize_ ? std::min<size_t>(supportSize_, E) : E);
+      std::nth_element(order.begin(), order.begin() + (k - 1), order.end(), likelier);
+      size_t best = *std::min_element(order.begin(), order.begin() + k, likelier);
+      support_.clear();
+      double mass = 0.0;
+      for (size_t i = 0; i < k; ++i) {
+	uint32_t e = order[i];
+	if (e != best && (candidates[e] <= 0.0 || candidates[e] < supportThreshold_)) continue;
+	support_.push_back(e);
+	mass += candidates[e];
+      }
+      std::sort(support_.begin(), support_.end());
+      residual_ = std::max(0.0, 1.0 - mass);
+
+      EnvProb * envbelief = &graph_.envbeliefs[graph_.beliefs[graph_.root].envbelief];
+      std::fill(envbelief, envbelief + E, EnvProb(0));
+      for (auto e : support_) envbelief[e] = candidates[e] / mass;
+    }
+
+    template <typename M>
+    bool PAMCP<M>::restricted() const {
+      return supportThreshold_ > 0 || supportSize_ || clusterThreshold_ > 0;
+    }
+
+    template <typename M>
+    double PAMCP<M>::rootProbability(size_t e) const {
+      if (restricted() && !rootBelief_.empty()) return rootBelief_[e];
+      return (&graph_.envbeliefs[graph_.beliefs[graph_.root].envbelief])[e];
+    }
+
+    template <typename M>
+    void PAMCP<M>::buildClusters() {
+      // Symmetrized KL divergence of the transitions of each pair of environments
+      const double eps = 1e-6;
+      std::vector<double> dist(E * E, 0.0);
+      for (size_t o = 0; o < O; ++o) {
+	auto begin = links_.begin() + linkStart_[o], end = links_.begin() + linkStart_[o + 1];
+	for (size_t e = 0; e < E; ++e) {
+	  for (size_t f = e + 1; f < E; ++f) {
+	    double d = 0.0;
+	    for (size_t a = 0; a < A; ++a) {
+	      for (auto it = begin; it != end; ++it) {
+		size_t o2 = *it;
+		double p = model_.getTransitionProbability(e * O + o, a, e * O + o2);
+		double q = model_.getTransitionProbability(f * O + o, a, f * O + o2);
+		d += (p - q) * (std::log(p + eps) - std::log(q + eps));
+	      }
+	    }
+	    dist[e * E + f] += d;
+	    dist[f * E + e] += d;
+	  }
+	}
+      }
+
+      // Average linkage, with the medoid of each merge
+      clusters_.clear();
+      std::vector<std::vector<uint32_t>> members;
+      for (size_t e = 0; e < E; ++e) {
+	clusters_.push_back(Cluster{NONE, NONE, static_cast<uint32_t>(e)});
+	members.emplace_back(1, e);
+      }
+      std::vector<double> linkage(dist);
+      std::vector<uint32_t> active(E);
+      std::iota(active.begin(), active.end(), 0);
+      std::vector<uint32_t> id(active); // Cluster of each active row of linkage
+      while (active.size() > 1) {
+	size_t bi = 0, bj = 1;
+	for (size_t i = 0; i < active.size(); ++i)
+	  for (size_t j = i + 1; j < active.size(); ++j)
+	    if (linkage[active[i] * E + active[j]] < linkage[active[bi] * E + active[bj]]) { bi = i; bj = j; }
+	uint32_t x = active[bi], y = active[bj];
+	double nx = members[id[x]].size(), ny = members[id[y]].size();
+	for (auto z : active) {
+	  if (z == x || z == y) continue;
+	  linkage[x * E + z] = linkage[z * E + x] = (nx * linkage[x * E + z] + ny * linkage[y * E + z]) / (nx + ny);
+	}
+	std::vector<uint32_t> merged(members[id[x]]);
+	merged.insert(merged.end(), members[id[y]].begin(), members[id[y]].end());
+	uint32_t medoid = merged[0];
+	double best = std::numeric_limits<double>::infinity();
+	for (auto e : merged) {
+	  double sum = 0.0;
+	  for (auto f : merged) sum += dist[e * E + f];
+	  if (sum < best) { best = sum; medoid = e; }
+	}
+	clusters_.push_back(Cluster{id[x], id[y], medoid});
+	members.push_back(std::move(merged));
+	// The row of x now holds the merged cluster
+	id[x] = clusters_.size() - 1;
+	active.erase(active.begin() + bj);
+      }
+    }
+
+    template <typename M>
+    void PAMCP<M>::materialize(Tree & t, uint32_t parent, size_t a, uint32_t b) {
+      auto & node = t.beliefs[b];
+      if (!with_exact_belief || node.envbelief != NONE) return;
+      auto & p = t.beliefs[parent];
+      uint32_t envbelief = t.envbeliefs.allocate(E);
+      updateBelief(&t.envbeliefs[p.envbelief], likelihood(p.obs, a, linkOf(p.obs, node.obs), node.obs), &t.envbeliefs[envbelief]);
+      node.envbelief = envbelief;
+    }
+
+    template <typename M>
+    uint64_t PAMCP<M>::beliefKey(size_t o, const EnvProb * belief, unsigned levels) const {
+      // FNV-1a over the observation and the quantized entries
+      uint64_t h = 14695981039346656037ULL;
+      auto mix = [&h](uint64_t x) { h = (h ^ x) * 1099511628211ULL; };
+      mix(o);
+      for (size_t e = 0; e < E; ++e) mix(static_cast<uint64_t>(belief[e] * levels + 0.5));
+      return h;
+    }
+
+    template <typename M>
+    uint32_t PAMCP<M>::transpose(Tree & t, uint32_t b, size_t a, uint32_t link, size_t o, unsigned togo, std::vector<EnvProb> & posterior, bool & created) {
+      auto & parent = t.beliefs[b];
+      if (support_.empty()) posterior.resize(E);
+      else posterior.assign(E, EnvProb(0));
+      updateBelief(&t.envbeliefs[parent.envbelief], likelihood(parent.obs, a, link, o), posterior.data());
+      // The remaining horizon is folded in the observation, as in bookKey
+      uint64_t key = beliefKey(o + O * togo, posterior.data(), transpositionLevels_);
+
+      std::unique_lock<std::mutex> lock;
+      if (sharedTree_) lock = std::unique_lock<std::mutex>(transpositionLock_.m[0]);
+      auto it = t.transpositions.find(key);
+      created = (it == t.transpositions.end());
+      // A hit is checked against the node, whose belief was quantized into the same key:
+      // a hash collision gets a node of its own, out of the table
+      if (!created && sameKey(t, it->second, o, togo, posterior.data())) return it->second.node;
+      uint32_t c = newBeliefNode(t, o);
+      auto & node = t.beliefs[c];
+      node.envbelief = t.envbeliefs.allocate(E);
+      std::copy(posterior.begin(), posterior.end(), &t.envbeliefs[node.envbelief]);
+      if (created) t.transpositions.emplace(key, Transposition{c, togo});
+      created = true;
+      return c;
+    }
+
+    template <typename M>
+    bool PAMCP<M>::sameKey(const Tree & t, const Transposition & entry, size_t o, unsigned togo, const EnvProb * belief) const {
+      auto & node = t.beliefs[entry.node];
+      if (entry.togo != togo || node.obs != o) return false;
+      const EnvProb * other = &t.envbeliefs[node.envbelief];
+      const unsigned levels = transpositionLevels_;
+      for (size_t e = 0; e < E; ++e)
+	if (static_cast<uint64_t>(belief[e] * levels + 0.5) != static_cast<uint64_t>(other[e] * levels + 0.5)) return false;
+      return true;
+    }
+
+    template <typename M>
+    bool PAMCP<M>::posteriorOf(uint32_t b, size_t a, size_t o, Belief & posterior) {
+      auto & node = graph_.beliefs[b];
+      uint32_t link = linkOf(node.obs, o);
+      if (link == NONE) return false;
+      const double * lik = likelihood(node.obs, a, link, o);
+      posterior = Belief(E);
+      posterior.fill(0.0);
+      if (with_exact_belief) {
+	if (node.envbelief == NONE) return false;
+	const EnvProb * prior = &graph_.envbeliefs[node.envbelief];
+	for (size_t e = 0; e < E; ++e) posterior(e) = prior[e] * lik[e];
+      } else {
+	node.smplbelief.forEach([&posterior, lik](size_t e, uint32_t n) { posterior(e) = n * lik[e]; });
+      }
+      double nrm = posterior.sum();
+      if (nrm <= 0.0) return false;
+      posterior /= nrm;
+      return true;
+    }
+
+    template <typename M>
+    typename PAMCP<M>::Slot * PAMCP<M>::addChild(Tree & t, uint32_t b, size_t a, size_t o) {
+      expand(t, b, A);
+      auto & node = t.beliefs[b];
+      uint32_t link = linkOf(node.obs, o);
+      if (link == NONE) return nullptr;
+      auto & branch = t.slots[node.children + rankOf(node.obs, a)];
+      if (branch.node == NONE) branch.node = t.slots.allocate(nLinks(node.obs));
+      auto & slot = t.slots[branch.node + link];
+      if (slot.node == NONE) {
+	if (transpositionLevels_) {
+	  std::vector<EnvProb> posterior;
+	  bool created;
+	  slot.node = transpose(t, b, a, link, o, maxDepth_ - std::min(maxDepth_, 1u), posterior, created);
+	} else {
+	  slot.node = newBeliefNode(t, o);
+	}
+      }
+      return &slot;
+    }
+
+    template <typename M>
+    uint32_t PAMCP<M>::newBeliefNode(Tree & t, size_t o) {
+      uint32_t b = t.beliefs.allocate(1);
+      t.beliefs[b].obs = o;
+      return b;
+    }
+
+    template <typename M>
+    void PAMCP<M>::expand(Tree & t, uint32_t b, size_t n) {
+      auto & node = t.beliefs[b];
+      if (wideningC_ <= 0 || sharedTree_) n = A;
+      uint32_t actions = node.actions.load(std::memory_order_relaxed);
+      if (actions != NONE && node.ranks >= n) return;
+      if (actions == NONE) {
+	if (wideningC_ > 0) rankActions(node.obs);
+	node.children = t.slots.allocate(n);
+	node.actions.store(t.stats.allocate(3 * n), std::memory_order_relaxed);
+	node.ranks = n;
+	return;
+      }
+
+      // The stats (V, N and VL blocks) and slots move to a larger block,
+      // the old one is lost until the tree is copied
+      size_t old = node.ranks;
+      n = std::min<size_t>(A, std::max(n, 2 * old));
+      uint32_t children = t.slots.allocate(n), grown = t.stats.allocate(3 * n);
+      for (size_t k = 0; k < 3; ++k)
+	std::copy(&t.stats[actions + k * old], &t.stats[actions + k * old] + old, &t.stats[grown + k * n]);
+      std::copy(&t.slots[node.children], &t.slots[node.children] + old, &t.slots[children]);
+      node.children = children;
+      node.actions.store(grown, std::memory_order_relaxed);
+      node.ranks = n;
+    }
+
+    template <typename M>
+    typename PAMCP<M>::Slot * PAMCP<M>::findSlot(Tree & t, uint32_t b, size_t a, size_t o) {
+      if (b == NONE) return nullptr;
+      auto & node = t.beliefs[b];
+      if (node.actions == NONE) return nullptr;
+      size_t r = rankOf(node.obs, a);
+      if (r >= node.ranks) return nullptr;
+      uint32_t slots = t.slots[node.children + r].node;
+      uint32_t link = linkOf(node.obs, o);
+      if (slots == NONE || link == NONE) return nullptr;
+      return &t.slots[slots + link];
+    }
+
+    template <typename M>
+    uint32_t PAMCP<M>::copyBeliefNode(const Tree & from, uint32_t b, Tree & to) {
+      auto & node = from.beliefs[b];
+      uint32_t c = newBeliefNode(to, node.obs);
+      auto & copy = to.beliefs[c];
+      if (node.envbelief != NONE) {
+	copy.envbelief = to.envbeliefs.allocate(E);
+	std::copy(&from.envbeliefs[node.envbelief], &from.envbeliefs[node.envbelief] + E, &to.envbeliefs[copy.envbelief]);
+      }
+      copy.smplbelief = node.smplbelief;
+      return c;
+    }
+
+    template <typename M>
+    uint32_t PAMCP<M>::copySubtree(const Tree & from, uint32_t b, Tree & to, unsigned minN /* 0 */) {
+      std::vector<uint32_t> copies(transpositionLevels_ ? from.beliefs.size() : 0, NONE);
+      uint32_t c = copyNodes(from, b, to, minN, copies);
+      for (auto & entry : from.transpositions) {
+	if (copies[entry.second.node] != NONE) to.transpositions.emplace(entry.first, Transposition{copies[entry.second.node], entry.second.togo});
+      }
+      return c;
+    }
+
+    template <typename M>
+    uint32_t PAMCP<M>::copyNodes(const Tree & from, uint32_t b, Tree & to, unsigned minN, std::vector<uint32_t> & copies) {
+      if (copies.size() && copies[b] != NONE) return copies[b];
+      auto & node = from.beliefs[b];
+      uint32_t c = copyBeliefNode(from, b, to);
+      if (copies.size()) copies[b] = c;
+      auto & copy = to.beliefs[c];
+      copy.N = node.N.load();
+      if (node.actions == NONE) return c;
+
+      size_t ranks = node.ranks;
+      expand(to, c, ranks);
+      // V and N are copied, pending simulations (VL) are not
+      std::copy(&from.stats[node.actions], &from.stats[node.actions] + 2 * ranks, &to.stats[copy.actions]);
+      for (size_t a = 0; a < ranks; ++a) {
+	uint32_t slots = from.slots[node.children + a].node;
+	if (slots == NONE) continue;
+	size_t n = nLinks(node.obs);
+	uint32_t cslots = NONE;
+	for (size_t l = 0; l < n; ++l) {
+	  uint32_t child = from.slots[slots + l].node;
+	  if (child == NONE || from.beliefs[child].N < minN) continue;
+	  // The link slots are allocated with the first kept child
+	  if (cslots == NONE) {
+	    cslots = to.slots.allocate(n);
+	    to.slots[copy.children + a].node = cslots;
+	  }
+	  to.slots[cslots + l].node = copyNodes(from, child, to, minN, copies);
+	}
+      }
+      return c;
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::treeBytes(const Tree & t) const {
+      size_t bytes = t.used();
+      if (!with_exact_belief) {
+	for (size_t b = 0; b < t.beliefs.size(); ++b)
+	  bytes += t.beliefs[b].smplbelief.bytes();
+      }
+      return bytes;
+    }
+
+    template <typename M>
+    void PAMCP<M>::listNodes(uint32_t b, std::vector<std::pair<unsigned, size_t> > & nodes, std::vector<bool> & listed) const {
+      if (listed.size()) {
+	if (listed[b]) return;
+	listed[b] = true;
+      }
+      auto & node = graph_.beliefs[b];
+      size_t bytes = sizeof(BeliefNode) + node.smplbelief.bytes();
+      if (node.envbelief != NONE) bytes += E * sizeof(EnvProb);
+      if (node.actions != NONE) bytes += node.ranks * (3 * sizeof(Stat) + sizeof(Slot));
+      // Children are appended after the node: its entry is updated by index
+      size_t self = nodes.size();
+      nodes.emplace_back(node.N.load(), bytes);
+      if (node.actions == NONE) return;
+
+      for (size_t a = 0; a < node.ranks; ++a) {
+	uint32_t slots = graph_.slots[node.children + a].node;
+	if (slots == NONE) continue;
+	size_t n = nLinks(node.obs);
+	nodes[self].second += n * sizeof(Slot);
+	for (size_t l = 0; l < n; ++l) {
+	  uint32_t child = graph_.slots[slots + l].node;
+	  if (child != NONE) listNodes(child, nodes, listed);
+	}
+      }
+    }
+
+    template <typename M>
+    void PAMCP<M>::prune() {
+      if (treeBytes(graph_) <= memoryBudget_) return;
+
+      std::vector<std::pair<unsigned, size_t> > nodes;
+      std::vector<bool> listed(transpositionLevels_ ? graph_.beliefs.size() : 0, false);
+      listNodes(fullroot_, nodes, listed);
+      std::sort(nodes.begin(), nodes.end(), std::greater<std::pair<unsigned, size_t> >());
+
+      // Find the lowest visit count whose nodes fit in the target.
+      // The root has the most visits and is always kept.
+      size_t target = memoryBudget_ / 4 * 3, kept = 0;
+      unsigned minN = nodes[0].first;
+      for (size_t i = 0; i < nodes.size(); ) {
+	size_t j = i, bytes = 0;
+	for ( ; j < nodes.size() && nodes[j].first == nodes[i].first; ++j) bytes += nodes[j].second;
+	if ( i && kept + bytes > target ) break;
+	kept += bytes;
+	minN = nodes[i].first;
+	i = j;
+      }
+
+      // The old pools are freed rather than kept for later
+      Tree pruned(treeBase_);
+      pruned.root = copySubtree(graph_, fullroot_, pruned, minN);
+      graph_.swap(pruned);
+      fullroot_ = graph_.root;
+    }
+
+    template <typename M>
+    void PAMCP<M>::dropDetached() {
+      // The nodes added since the last failure are in its detached tree
+      if (detachedFrom_) {
+	detachedBytes_ += graph_.used() - detachedFrom_;
+	detachedFrom_ = 0;
+      }
+      // Copying the past-aware tree is only worth it once a quarter of the pools is lost
+      if (detachedBytes_ * 4 <= graph_.used()) return;
+      Tree kept(treeBase_);
+      kept.root = copySubtree(graph_, fullroot_, kept);
+      graph_.swap(kept);
+      fullroot_ = graph_.root;
+      detachedBytes_ = 0;
+    }
+
+    template <typename M>
+    void PAMCP<M>::compact(Tree & t, uint32_t b) {
+      scratch_.clear();
+      scratch_.root = copySubtree(t, b, scratch_);
+      t.swap(scratch_);
+      scratch_.clear();
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::runSimulation(unsigned horizon) {
+      simulations_ = 0;
+      booked_ = false;
+      identifiedEnv_ = NONE;
+      if ( !horizon ) return 0;
+
+      // An identified environment is played with its MDP policy
+      if (identifiedThreshold_ > 0) {
+	identifiedEnv_ = identifiedEnvironment();
+	if (identifiedEnv_ != NONE) return identifiedPolicy_[identifiedEnv_ * O + graph_.beliefs[graph_.root].obs];
+      }
+
+      maxDepth_ = horizon;
+      // Pondering may follow a decision read from the book: it needs these too
+      if (mdpLeaves_) solveLeafValues(maxDepth_);
+      if (with_exact_belief) {
+	rootProb_.resize(E);
+	rootAlias_.resize(E);
+	buildAlias(&graph_.envbeliefs[graph_.beliefs[graph_.root].envbelief], E, rootProb_.data(), rootAlias_.data());
+      }
+
+      // The first decisions of a session may be read from the opening book
+      uint64_t key = 0;
+      bool book = (bookDepth_ && sessionDepth_ < bookDepth_);
+      if (book) {
+	key = bookKey();
+	if (readBook(key)) {
+	  auto & root = graph_.beliefs[graph_.root];
+	  size_t best = actionOf(root.obs, findBestA(&graph_.stats[root.actions]));
+	  startPondering();
+	  return best;
+	}
+      }
+
+      // Without an explicit deadline, the time budget starts now
+      budget_ = stepBudget(horizon);
+      Clock::time_point deadline = deadline_;
+      if (!hasDeadline_ && timeBudget_ > 0)
+	deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(timeBudget_ * budget_ / std::max(1u, iterations_)));
+      const Clock::time_point * until = (hasDeadline_ || timeBudget_ > 0) ? &deadline : nullptr;
+
+      // Root parallelization: workers grow their own tree from the
+      // same root belief while this thread grows graph_.
+      // Tree parallelization: everyone grows graph_.
+      // The simulations pondered in the root are already done.
+      unsigned total = budget_ - std::min(budget_, ponderCredit_);
+      ponderCredit_ = 0;
+      unsigned share = total / threads_;
+      bool early = (stopDelta_ > 0);
+      if (early) {
+	rootStats_ = &graph_.stats[graph_.beliefs[graph_.root].actions];
+	rootReturns_.assign(3 * A, Stat());
+	rootLow_.value = std::numeric_limits<double>::infinity();
+	rootHigh_.value = -std::numeric_limits<double>::infinity();
+      }
+      std::vector<unsigned> done(workers_.size(), 0);
+      std::vector<std::thread> pool;
+      for (size_t i = 0; i < workers_.size(); ++i) {
+	auto & w = workers_[i];
+	if (sharedTree_) {
+	  pool.emplace_back([this, &w, &done, i, share, until, early]() { done[i] = runIterations(graph_, share, w.rand, until, early); });
+	  continue;
+	}
+	if (!w.valid) {
+	  w.tree.clear();
+	  w.tree.root = copyBeliefNode(graph_, graph_.root, w.tree);
+	  expand(w.tree, w.tree.root, A);
+	  w.valid = true;
+	}
+	pool.emplace_back([this, &w, &done, i, share, until, early]() { done[i] = runIterations(w.tree, share, w.rand, until, early); });
+      }
+      simulations_ = runIterations(graph_, total - share * workers_.size(), rand_, until, early);
+      for (auto & t : pool) t.join();
+      rootStats_ = nullptr;
+      for (auto n : done) simulations_ += n;
+      sessionSpent_ += simulations_;
+
+      if (workers_.size() && !sharedTree_) mergeRoots();
+      if (book) writeBook(key);
+
+      auto & root = graph_.beliefs[graph_.root];
+      size_t best = actionOf(root.obs, findBestA(&graph_.stats[root.actions]));
+      startPondering();
+      return best;
+    }
+
+    template <typename M>
+    void PAMCP<M>::startPondering() {
+      if (!ponderSimulations_) return;
+      auto & root = graph_.beliefs[graph_.root];
+      if (root.actions == NONE || (!with_exact_belief && !root.smplbelief.size())) return;
+
+      // The children of the root are below the horizon
+      if (maxDepth_ < 2) return;
+
+      // Visits of the children of the root before pondering, and
+      // weight of each child: visits of its action times the
+      // probability of its observation
+      size_t n = nLinks(root.obs);
+      const Stat * N = &graph_.stats[root.actions] + root.ranks;
+      double total = root.smplbelief.size();
+      ponderBase_.assign(A * n, 0);
+      std::vector<double> weights(A * n, 0.0);
+      double sum = 0.0;
+      for (size_t r = 0; r < root.ranks; ++r) {
+	uint32_t slots = graph_.slots[root.children + r].node;
+	double visits = N[r].value;
+	if (!visits) continue;
+	size_t a = actionOf(root.obs, r);
+	for (size_t l = 0; l < n; ++l) {
+	  size_t o = links_[linkStart_[root.obs] + l];
+	  uint32_t child = (slots == NONE ? NONE : graph_.slots[slots + l].node.load());
+	  if (child != NONE) ponderBase_[r * n + l] = graph_.beliefs[child].N;
+	  // Particle children are only pondered once a simulation left particles there
+	  if (model_.isTerminal(o) || (!with_exact_belief && (child == NONE || !graph_.beliefs[child].smplbelief.size()))) continue;
+	  const double * lik = likelihood(root.obs, a, l, o);
+	  double p = 0.0;
+	  if (with_exact_belief) {
+	    const EnvProb * belief = &graph_.envbeliefs[root.envbelief];
+	    for (size_t e = 0; e < E; ++e) p += belief[e] * lik[e];
+	  } else {
+	    root.smplbelief.forEach([&p, lik, total](size_t e, uint32_t k) { p += k / total * lik[e]; });
+	  }
+	  sum += (weights[r * n + l] = visits * p);
+	}
+      }
+      if (!(sum > 0)) return;
+
+      ponder_.stop = false;
+      ponder_.thread = std::thread([this, n, weights]() {
+	  std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+	  std::vector<unsigned> counts(weights.size());
+	  unsigned done = 0;
+	  while (done < ponderSimulations_ && !ponder_.stop) {
+	    std::lock_guard<std::mutex> lock(ponder_.m);
+	    // Each simulation of the chunk draws its child
+	    std::fill(counts.begin(), counts.end(), 0);
+	    for (unsigned i = std::min(PONDER_CHUNK, ponderSimulations_ - done); i; --i) ++counts[pick(ponderRand_)];
+	    for (size_t k = 0; k < counts.size(); ++k)
+	      if (counts[k]) done += ponderChild(k / n, k % n, counts[k]);
+	  }
+	});
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::ponderChild(size_t r, uint32_t l, unsigned n) {
+      uint32_t root = graph_.root;
+      size_t obs = graph_.beliefs[root].obs, a = actionOf(obs, r), o = links_[linkStart_[obs] + l];
+      uint32_t b = addChild(graph_, root, a, o)->node;
+      materialize(graph_, root, a, b);
+      auto & node = graph_.beliefs[b];
+      std::vector<Descent> batch(rolloutBatch_);
+      Rollouts buf;
+      std::uniform_real_distribution<double> uniform(0.0, 1.0);
+      unsigned i = 0;
+      while (i < n) {
+	size_t k = 0;
+	for ( ; k < batch.size() && i < n; ++k, ++i ) {
+	  size_t e = 0;
+	  if (!with_exact_belief) {
+	    e = node.smplbelief.sample(ponderRand_);
+	  } else {
+	    const EnvProb * belief = &graph_.envbeliefs[node.envbelief];
+	    double u = uniform(ponderRand_), cum = belief[0];
+	    while (u > cum && e + 1 < E) cum += belief[++e];
+	  }
+	  descend(graph_, b, O * e + o, ponderRand_, batch[k], 1);
+	}
+	rollouts(batch.data(), k, ponderRand_, buf);
+	for (size_t j = 0; j < k; ++j) backup(graph_, batch[j]);
+      }
+      return i;
+    }
+
+    template <typename M>
+    void PAMCP<M>::stopPondering() {
+      ponder_.halt();
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::ponderedVisits(size_t a, size_t o) {
+      if (ponderBase_.empty()) return 0;
+      Slot * slot = findSlot(graph_, graph_.root, a, o);
+      unsigned visits = 0;
+      if (slot && slot->node != NONE) {
+	auto & root = graph_.beliefs[graph_.root];
+	unsigned N = graph_.beliefs[slot->node].N;
+	unsigned base = ponderBase_[rankOf(root.obs, a) * nLinks(root.obs) + linkOf(root.obs, o)];
+	visits = N - std::min(N, base);
+      }
+      ponderBase_.clear();
+      return visits;
+    }
+
+    template <typename M>
+    uint64_t PAMCP<M>::bookKey() const {
+      auto & root = graph_.beliefs[graph_.root];
+      return beliefKey(root.obs + O * maxDepth_, &graph_.envbeliefs[root.envbelief], bookLevels_);
+    }
+
+    template <typename M>
+    bool PAMCP<M>::readBook(uint64_t key) {
+      auto it = book_.find(key);
+      if (it == book_.end()) return false;
+      auto & entry = it->second;
+      double total = bookVisits(key);
+      if (total < (bookSimulations_ ? bookSimulations_ : iterations_)) return false;
+      // Every refresh-th use searches again
+      if (bookRefresh_ && (entry.hits + 1) % bookRefresh_ == 0) {
+	++entry.hits;
+	return false;
+      }
+
+      // A past-aware root may already know more than the book
+      auto & root = graph_.beliefs[graph_.root];
+      if (root.N < total) {
+	Stat * V = &graph_.stats[root.actions], * N = V + A;
+	for (size_t r = 0; r < A; ++r) {
+	  size_t a = actionOf(root.obs, r);
+	  V[r].value = entry.V[a];
+	  N[r].value = entry.N[a];
+	}
+	root.N = static_cast<unsigned>(total);
+      }
+      ++entry.hits;
+      booked_ = true;
+      return true;
+    }
+
+    template <typename M>
+    double PAMCP<M>::bookVisits(uint64_t key) const {
+      auto it = book_.find(key);
+      if (it == book_.end()) return 0.0;
+      return std::accumulate(it->second.N.begin(), it->second.N.end(), 0.0);
+    }
+
+    template <typename M>
+    void PAMCP<M>::writeBook(uint64_t key) {
+      auto & root = graph_.beliefs[graph_.root];
+      const Stat * V = &graph_.stats[root.actions], * N = V + A;
+      auto & entry = book_[key];
+      if (entry.V.empty()) {
+	entry.V.assign(A, 0.0);
+	entry.N.assign(A, 0.0);
+      }
+      for (size_t r = 0; r < A; ++r) {
+	size_t a = actionOf(root.obs, r);
+	double n = N[r].value;
+	// The root statistics of a past-aware tree already include the previous searches
+	if (with_tree) {
+	  entry.V[a] = V[r].value;
+	  entry.N[a] = n;
+	} else if (n > 0) {
+	  entry.V[a] = (entry.V[a] * entry.N[a] + V[r].value * n) / (entry.N[a] + n);
+	  entry.N[a] += n;
 	}
-	else {
-	  if (!with_exact_belief)
-	    ot->second.smplbelief.push_back(s1);
+      }
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::runIterations(Tree & t, unsigned n, std::default_random_engine & rng, const Clock::time_point * deadline, bool early /* false */) {
+      auto & root = t.beliefs[t.root];
+      // Exact root environments are stratified over the n simulations, or drawn from the alias table of the root
+      std::vector<uint32_t> strata;
+      if (with_exact_belief && stratifiedRoot_ && !deadline) stratify(&t.envbeliefs[root.envbelief], n, rng, strata);
+      std::vector<Descent> batch(rolloutBatch_);
+      Rollouts buf;
+      unsigned i = 0;
+      // The clock is read before the first simulation, then every DEADLINE_CHECK simulations
+      auto running = [&]() {
+	if (early && i && i % stopInterval_ == 0 && separated()) return false;
+	return deadline ? (i % DEADLINE_CHECK || Clock::now() < *deadline) : i < n;
+      };
+      while ( running() ) {
+	size_t k = 0;
+	for ( ; k < batch.size() && running(); ++k, ++i ) {
+	  size_t e;
+	  if (!with_exact_belief) e = root.smplbelief.sample(rng);
+	  else e = (strata.size() ? strata[i] : sampleAlias(rootProb_.data(), rootAlias_.data(), E, rng));
+	  size_t s = O * e + root.obs;
+	  descend(t, t.root, s, rng, batch[k]);
+	}
+	rollouts(batch.data(), k, rng, buf);
+	for (size_t j = 0; j < k; ++j) backup(t, batch[j]);
+      }
+      return i;
+    }
+
+    template <typename M>
+    void PAMCP<M>::stratify(const EnvProb * belief, unsigned n, std::default_random_engine & rng, std::vector<uint32_t> & strata) const {
+      // Systematic sampling: the k-th simulation gets the environment at the quantile (k + u) / n
+      strata.resize(n);
+      double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng), cum = belief[0];
+      size_t e = 0;
+      for (unsigned k = 0; k < n; ++k) {
+	double q = (k + u) / n;
+	while (q > cum && e + 1 < E) cum += belief[++e];
+	strata[k] = e;
+      }
+      std::shuffle(strata.begin(), strata.end(), rng);
+    }
+
+    template <typename M>
+    void PAMCP<M>::mergeRoots() {
+      auto & root = graph_.beliefs[graph_.root];
+      Stat * V = &graph_.stats[root.actions], * N = V + A;
+      root.N = 0;
+      for (size_t a = 0; a < A; ++a) {
+	double sumV = V[a].value.load() * N[a].value.load();
+	double sumN = N[a].value;
+	for (auto & w : workers_) {
+	  const Stat * wV = &w.tree.stats[w.tree.beliefs[w.tree.root].actions], * wN = wV + A;
+	  sumV += wV[a].value.load() * wN[a].value.load();
+	  sumN += wN[a].value;
+	}
+	N[a].value = sumN;
+	V[a].value = (sumN ? sumV / sumN : 0.0);
+	root.N += static_cast<unsigned>(sumN);
+      }
+    }
+
+    template <typename M>
+    void PAMCP<M>::descend(Tree & t, uint32_t bi, size_t s, std::default_random_engine & rng, Descent & d, unsigned start /* 0 */) {
+      d.path.clear();
+      d.depth = maxDepth_;
+      for (unsigned depth = start; ; ++depth) {
+	auto & b = t.beliefs[bi];
+	b.N++;
+	size_t w = width(b.N);
+	if (w > b.ranks) expand(t, bi, w);
+	Stat * stats = &t.stats[b.actions];
+	size_t r = findBestBonusA(stats, b.ranks, b.N, w), a = actionOf(b.obs, r);
+	if (pendingLoss()) atomicAdd(stats[2 * b.ranks + r].value, 1.0);
+
+	size_t s1, o; double rew;
+	std::tie(s1, o, rew) = model_.sampleSOR(s, a, rng);
+	d.path.push_back({bi, static_cast<uint32_t>(r), rew});
+
+	bool expanded = false;
+	uint32_t next = NONE, child = NONE;
+	{
+	  // With a shared tree, modifications of the children of
+	  // (b, a) are serialized. Nodes never move in the pools.
+	  auto & branch = t.slots[b.children + r];
+	  std::unique_lock<std::mutex> lock;
+	  if (sharedTree_) lock = std::unique_lock<std::mutex>(nodeLock(&branch));
+	  // The slots for all the links of b are allocated at once
+	  uint32_t slots = branch.node.load(std::memory_order_relaxed);
+	  if (slots == NONE) {
+	    slots = t.slots.allocate(nLinks(b.obs));
+	    branch.node.store(slots, std::memory_order_relaxed);
+	  }
+	  uint32_t link = linkOf(b.obs, o);
+	  assert(("Sampled observation missing from the links", link != NONE));
+	  auto & slot = t.slots[slots + link];
+	  child = slot.node.load(std::memory_order_relaxed);
+	  // We need to append the node anyway to perform the belief
+	  // update for the next timestep. With transpositions, the
+	  // node may already exist elsewhere in the graph.
+	  if (child == NONE) {
+	    if (transpositionLevels_) {
+	      child = transpose(t, bi, a, link, o, maxDepth_ - (depth + 1), d.posterior, expanded);
+	    } else {
+	      expanded = true;
+	      child = newBeliefNode(t, o);
+	    }
+	    slot.node.store(child, std::memory_order_relaxed);
+	  }
+	  if (!with_exact_belief) {
+	    auto & particles = t.beliefs[child].smplbelief;
+	    // At the cap, a random particle makes room for the new one
+	    if (particleCap_ && particles.size() >= particleCap_) particles.remove(particles.sample(rng));
+	    particles.add(model_.get_env(s1), E);
+	  }
 	  // We only go deeper if needed (maxDepth_ is always at least 1).
-	  if ( depth + 1 < maxDepth_ && !model_.isTerminal(s1) ) {
+	  if ( !expanded && depth + 1 < maxDepth_ && !model_.isTerminal(s1) ) {
 	    // Since most memory is allocated on the leaves,
 	    // we do not allocate on node creation but only when
 	    // we are actually descending into a node. If the node
-	    // already has memory this should not do anything in
-	    // any case.
-	    ot->second.children.resize(A);
-	    futureRew = simulate( ot->second, s1, depth + 1 );
+	    // already has its actions this does not do anything.
+	    // The same goes for the exact belief.
+	    materialize(t, bi, a, child);
+	    // A transposed node may be expanded through another parent
+	    std::unique_lock<std::mutex> shared;
+	    if (transpositionLevels_ && sharedTree_) shared = std::unique_lock<std::mutex>(transpositionLock_.m[0]);
+	    expand(t, child, width(t.beliefs[child].N));
+	    next = child;
+	  }
+	}
+
+	// New nodes are evaluated by a rollout, which stops
+	// automatically if we go out of depth
+	if (expanded) {
+	  d.depth = depth + 1;
+	  d.belief = nullptr;
+	  if (!mdpLeaves_) {
+	    d.s = s;
+	    return;
+	  }
+	  // MDP leaves are valued at the new node: its state and its belief
+	  d.s = s1;
+	  if (with_exact_belief) {
+	    // With transpositions, the belief of the new node is already there
+	    if (!transpositionLevels_) {
+	      if (support_.empty()) d.posterior.resize(E);
+	      else d.posterior.assign(E, EnvProb(0));
+	      updateBelief(&t.envbeliefs[b.envbelief], likelihood(b.obs, a, linkOf(b.obs, o), o), d.posterior.data());
+	    }
+	    d.belief = d.posterior.data();
+	  }
+	  assert(("Leaf valued away from its node", model_.get_rep(d.s) == t.beliefs[child].obs));
+	  return;
+	}
+	if (next == NONE) return;
+	bi = next;
+	s = s1;
+      }
+    }
+
+    template <typename M>
+    void PAMCP<M>::backup(Tree & t, const Descent & d) {
+      double rew = d.value;
+      for (auto it = d.path.rbegin(); it != d.path.rend(); ++it) {
+	rew = it->rew + model_.getDiscount() * rew;
+	auto & b = t.beliefs[it->node];
+	updateAction(&t.stats[b.actions], b.ranks, it->a, rew);
+      }
+
+      // The returns of the root are tracked for early stopping
+      if (!rootStats_ || d.path.empty() || &t != &graph_ || d.path.front().node != graph_.root) return;
+      size_t r = d.path.front().a;
+      atomicAdd(rootReturns_[r].value, rew);
+      atomicAdd(rootReturns_[A + r].value, rew * rew);
+      atomicAdd(rootReturns_[2 * A + r].value, 1.0);
+      double low = rootLow_.value.load(std::memory_order_relaxed), high = rootHigh_.value.load(std::memory_order_relaxed);
+      while ( rew < low && !rootLow_.value.compare_exchange_weak(low, rew, std::memory_order_relaxed) );
+      while ( rew > high && !rootHigh_.value.compare_exchange_weak(high, rew, std::memory_order_relaxed) );
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::stepBudget(unsigned horizon) {
+      if (budgetFloor_ >= 1.0 && !sessionBudget_) return iterations_;
+      double w = budgetFloor_ + (1.0 - budgetFloor_) * rootEntropy() * horizon / std::max(horizon, sessionHorizon_);
+      sumWeights_ += w;
+      ++nWeights_;
+      double budget = std::max<double>(A, std::round(iterations_ * w * nWeights_ / sumWeights_));
+      if (sessionBudget_) budget = std::min<double>(budget, std::max<double>(A, sessionBudget_ - std::min(sessionSpent_, sessionBudget_)));
+      return static_cast<unsigned>(budget);
+    }
+
+    template <typename M>
+    double PAMCP<M>::rootEntropy() const {
+      if (E < 2) return 0.0;
+      auto & root = graph_.beliefs[graph_.root];
+      double h = 0.0;
+      if (with_exact_belief) {
+	for (size_t e = 0; e < E; ++e) {
+	  double p = rootProbability(e);
+	  if (p > 0) h -= p * std::log(p);
+	}
+      } else {
+	double total = root.smplbelief.size();
+	root.smplbelief.forEach([&h, total](size_t, uint32_t n) { h -= n / total * std::log(n / total); });
+      }
+      return h / std::log(static_cast<double>(E));
+    }
+
+    template <typename M>
+    bool PAMCP<M>::separated() const {
+      double range = rootHigh_.value.load() - rootLow_.value.load();
+      if (!(range > 0)) return false;
+      const Stat * sum = rootReturns_.data(), * sq = sum + A, * count = sq + A;
+      // The leader and its bounds come from the returns of the current search only:
+      // the root statistics of a past-aware tree also hold earlier searches
+      size_t best = A;
+      double top = -std::numeric_limits<double>::infinity();
+      for (size_t r = 0; r < A; ++r) {
+	double n = count[r].value.load();
+	if (n > 0 && sum[r].value.load() / n > top) {
+	  top = sum[r].value.load() / n;
+	  best = r;
+	}
+      }
+      // The search must also end up recommending it
+      if (best == A || best != findBestA(rootStats_)) return false;
+      double l = std::log(3.0 * std::max<size_t>(1, A - 1) / stopDelta_);
+      // Empirical Bernstein bound on the mean return of a root action
+      auto bound = [&](size_t r, double sign) {
+	double n = count[r].value.load(), mean = sum[r].value.load() / n;
+	double var = std::max(0.0, sq[r].value.load() / n - mean * mean) * n / (n - 1);
+	return mean + sign * (std::sqrt(2 * var * l / n) + 3 * range * l / (n - 1));
+      };
+      if (count[best].value.load() < 2) return false;
+      double lower = bound(best, -1.0);
+      for (size_t r = 0; r < A; ++r) {
+	if (r == best) continue;
+	double n = count[r].value.load();
+	// Actions left out by progressive widening are not candidates
+	if (wideningC_ > 0 && !rootStats_[A + r].value.load()) continue;
+	if (n < 2 || bound(r, 1.0) >= lower) return false;
+      }
+      return true;
+    }
+
+    template <typename M>
+    bool PAMCP<M>::pendingLoss() const {
+      return sharedTree_ || rolloutBatch_ > 1;
+    }
+
+    template <typename M>
+    void PAMCP<M>::updateAction(Stat * stats, size_t ranks, size_t a, double rew) {
+      auto & V = stats[a].value, & N = stats[ranks + a].value;
+      if (sharedTree_) {
+	double n = atomicAdd(N, 1.0);
+	double v = V.load(std::memory_order_relaxed);
+	while ( !V.compare_exchange_weak(v, v + (rew - v) / n, std::memory_order_relaxed) );
+	atomicAdd(stats[2 * ranks + a].value, -1.0);
+      } else {
+	double n = N.load(std::memory_order_relaxed) + 1.0;
+	N.store(n, std::memory_order_relaxed);
+	double v = V.load(std::memory_order_relaxed);
+	V.store(v + (rew - v) / n, std::memory_order_relaxed);
+	if (pendingLoss()) {
+	  auto & VL = stats[2 * ranks + a].value;
+	  VL.store(VL.load(std::memory_order_relaxed) - 1.0, std::memory_order_relaxed);
+	}
+      }
+    }
+
+    template <typename M>
+    double PAMCP<M>::atomicAdd(std::atomic<double> & x, double d) {
+      double v = x.load(std::memory_order_relaxed);
+      while ( !x.compare_exchange_weak(v, v + d, std::memory_order_relaxed) );
+      return v + d;
+    }
+
+    template <typename M>
+    std::mutex & PAMCP<M>::nodeLock(const void * node) {
+      return locks_.m[(reinterpret_cast<uintptr_t>(node) >> 4) % locks_.m.size()];
+    }
+
+    template <typename M>
+    void PAMCP<M>::rollouts(Descent * batch, size_t n, std::default_random_engine & rng, Rollouts & buf) {
+      buf.lane.clear(); buf.s.clear(); buf.depth.clear();
+      for (size_t k = 0; k < n; ++k) {
+	batch[k].value = 0.0;
+	if (batch[k].depth >= maxDepth_) continue;
+	if (mdpLeaves_) {
+	  batch[k].value = leafValue(batch[k]);
+	  continue;
+	}
+	buf.lane.push_back(k);
+	buf.s.push_back(batch[k].s);
+	buf.depth.push_back(batch[k].depth);
+      }
+      buf.value.assign(buf.lane.size(), 0.0);
+
+      // All the rollouts start together, so they share the discount of the current step
+      for ( double gamma = 1.0; buf.lane.size(); gamma *= model_.getDiscount() ) {
+	size_t m = buf.lane.size();
+	buf.a.resize(m); buf.s2.resize(m); buf.r.resize(m);
+	for (size_t j = 0; j < m; ++j) buf.a[j] = rolloutAction(buf.s[j], rng);
+	model_.sample_batch(m, buf.s.data(), buf.a.data(), buf.s2.data(), buf.r.data(), rng);
+
+	// Finished rollouts are written back, running ones are packed
+	size_t kept = 0;
+	for (size_t j = 0; j < m; ++j) {
+	  double value = buf.value[j] + gamma * buf.r[j];
+	  if (buf.depth[j] + 1 >= maxDepth_) {
+	    batch[buf.lane[j]].value = value;
+	    continue;
 	  }
+	  buf.lane[kept] = buf.lane[j];
+	  buf.s[kept] = buf.s2[j];
+	  buf.depth[kept] = buf.depth[j] + 1;
+	  buf.value[kept] = value;
+	  ++kept;
+	}
+	buf.lane.resize(kept); buf.s.resize(kept); buf.depth.resize(kept); buf.value.resize(kept);
+      }
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::rolloutAction(size_t s, std::default_random_engine & rng) const {
+      if (!rolloutRows_) return std::uniform_int_distribution<size_t>(0, A-1)(rng);
+      size_t row = (rolloutRows_ == S ? s : model_.get_rep(s)) * A;
+      return sampleAlias(&rolloutProb_[row], &rolloutAlias_[row], A, rng);
+    }
+
+    template <typename M>
+    template <typename W>
+    void PAMCP<M>::buildAlias(const W * w, size_t n, float * prob, uint32_t * alias) const {
+      // Vose's method: each under-full entry is paired with an over-full one
+      std::vector<size_t> small, large;
+      std::vector<double> scaled(n);
+      double nrm = 0.0;
+      for (size_t i = 0; i < n; ++i) nrm += w[i];
+      for (size_t i = 0; i < n; ++i) {
+	prob[i] = 1.f;
+	alias[i] = i;
+	scaled[i] = (nrm > 0 ? w[i] * n / nrm : 1.0);
+	(scaled[i] < 1.0 ? small : large).push_back(i);
+      }
+      while ( !small.empty() && !large.empty() ) {
+	size_t l = small.back(), g = large.back();
+	small.pop_back(); large.pop_back();
+	prob[l] = scaled[l];
+	alias[l] = g;
+	scaled[g] -= 1.0 - scaled[l];
+	(scaled[g] < 1.0 ? small : large).push_back(g);
+      }
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::sampleAlias(const float * prob, const uint32_t * alias, size_t n, std::default_random_engine & rng) const {
+      size_t i = std::uniform_int_distribution<size_t>(0, n-1)(rng);
+      return (std::uniform_real_distribution<float>(0.f, 1.f)(rng) < prob[i] ? i : alias[i]);
+    }
+
+    template <typename M>
+    void PAMCP<M>::solveLeafValues(unsigned horizon) {
+      if (leafValues_.empty()) leafValues_.assign(S, 0.0);
+      // The successors of a state stay in its environment
+      for (size_t k = leafValues_.size() / S; k <= horizon; ++k) {
+	leafValues_.resize((k + 1) * S);
+	const double * prev = &leafValues_[(k - 1) * S];
+	double * values = &leafValues_[k * S];
+	for (size_t s = 0; s < S; ++s) {
+	  std::vector<size_t> successors = successorStates(s);
+	  double best = -std::numeric_limits<double>::infinity();
+	  for (size_t a = 0; a < A; ++a) best = std::max(best, mdpQValue(s, a, successors, prev));
+	  values[s] = best;
 	}
+      }
+    }
 
-	rew += model_.getDiscount() * futureRew;
+    template <typename M>
+    double PAMCP<M>::mdpQValue(size_t s, size_t a, const std::vector<size_t> & successors, const double * next) const {
+      double q = 0.0;
+      for (auto s2 : successors) {
+	double p = model_.getTransitionProbability(s, a, s2);
+	if (p > 0) q += p * (model_.getExpectedReward(s, a, s2) + model_.getDiscount() * next[s2]);
       }
+      return q;
+    }
 
-      // Action update
-      aNode.N++;
-      aNode.V += ( rew - aNode.V ) / static_cast<double>(aNode.N);
+    template <typename M>
+    size_t PAMCP<M>::identifiedEnvironment() const {
+      auto & root = graph_.beliefs[graph_.root];
+      if (with_exact_belief) {
+	// Never a medoid holding the mass of its cluster
+	size_t e = 0;
+	for (size_t f = 1; f < E; ++f)
+	  if (rootProbability(f) > rootProbability(e)) e = f;
+	return (rootProbability(e) > identifiedThreshold_) ? e : NONE;
+      }
+      size_t best = NONE;
+      uint32_t count = 0;
+      root.smplbelief.forEach([&best, &count](size_t e, uint32_t n) { if (n > count) { best = e; count = n; } });
+      return (count > identifiedThreshold_ * root.smplbelief.size()) ? best : NONE;
+    }
 
-      return rew;
+    template <typename M>
+    double PAMCP<M>::leafValue(const Descent & d) const {
+      const double * values = &leafValues_[(maxDepth_ - d.depth) * S];
+      if (!d.belief) return values[d.s];
+      size_t o = model_.get_rep(d.s);
+      double v = 0.0;
+      if (!support_.empty()) {
+	// A node of an older search may have mass out of the support
+	double mass = 0.0;
+	for (auto e : support_) {
+	  v += d.belief[e] * values[e * O + o];
+	  mass += d.belief[e];
+	}
+	if (mass > 0.0) return v / mass;
+	v = 0.0;
+      }
+      for (size_t e = 0; e < E; ++e) v += d.belief[e] * values[e * O + o];
+      return v;
     }
 
     template <typename M>
-    double PAMCP<M>::rollout(size_t s, unsigned depth) {
-      double rew = 0.0, totalRew = 0.0, gamma = 1.0;
+    size_t PAMCP<M>::findBestA(const Stat * stats) const {
+      // With progressive widening, the actions never tried are not candidates
+      const Stat * N = stats + A;
+      size_t best = 0;
+      for (size_t a = 1; a < A; ++a) {
+	if ( wideningC_ > 0 && !N[a].value.load() ) continue;
+	if ( stats[a].value.load() > stats[best].value.load() || (wideningC_ > 0 && !N[best].value.load()) ) best = a;
+      }
+      return best;
+    }
 
-      std::uniform_int_distribution<size_t> generator(0, A-1);
-      for ( ; depth < maxDepth_; ++depth ) {
-	std::tie( s, rew ) = model_.sampleSR( s, generator(rand_) );
+    template <typename M>
+    size_t PAMCP<M>::width(unsigned n) const {
+      if (wideningC_ <= 0) return A;
+      return std::min<size_t>(A, std::max(1.0, std::ceil(wideningC_ * std::pow(n, wideningAlpha_))));
+    }
 
-	totalRew += gamma * rew;
-	gamma *= model_.getDiscount();
+    template <typename M>
+    void PAMCP<M>::rankActions(size_t obs) {
+      auto & entry = orderIndex_[obs].node;
+      if (entry.load(std::memory_order_acquire) != NONE) return;
+      std::vector<double> prior(A, 0.0);
+      if (rolloutRows_) {
+	// The probabilities are read back from the alias tables, and
+	// per state rows are summed over the environments
+	for (size_t row = obs; row < rolloutRows_; row += O) {
+	  for (size_t a = 0; a < A; ++a) {
+	    prior[a] += rolloutProb_[row * A + a];
+	    prior[rolloutAlias_[row * A + a]] += 1.0 - rolloutProb_[row * A + a];
+	  }
+	}
+      } else {
+	for (size_t e = 0; e < E; ++e) {
+	  size_t s = e * O + obs;
+	  std::vector<size_t> successors = successorStates(s);
+	  for (size_t a = 0; a < A; ++a)
+	    for (auto s2 : successors) prior[a] += model_.getTransitionProbability(s, a, s2) * model_.getExpectedReward(s, a, s2);
+	}
       }
-      return totalRew;
+      // The actions by rank, then the rank of each action
+      uint32_t fresh = orders_.allocate(2 * A);
+      uint32_t * order = &orders_[fresh], * rank = order + A;
+      std::iota(order, order + A, 0);
+      std::stable_sort(order, order + A, [&prior](uint32_t x, uint32_t y) { return prior[x] > prior[y]; });
+      for (size_t r = 0; r < A; ++r) rank[order[r]] = r;
+      // With a shared tree, another thread may have ranked the observation meanwhile
+      uint32_t none = NONE;
+      entry.compare_exchange_strong(none, fresh, std::memory_order_acq_rel);
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::actionOf(size_t obs, size_t r) const {
+      if (wideningC_ <= 0) return r;
+      return orders_[orderIndex_[obs].node.load(std::memory_order_acquire) + r];
     }
 
     template <typename M>
-    template <typename Iterator>
-    Iterator PAMCP<M>::findBestA(Iterator begin, Iterator end) {
-      return std::max_element(begin, end, [](const ActionNode & lhs, const ActionNode & rhs){ return lhs.V < rhs.V; });
+    size_t PAMCP<M>::rankOf(size_t obs, size_t a) const {
+      if (wideningC_ <= 0) return a;
+      return orders_[orderIndex_[obs].node.load(std::memory_order_acquire) + A + a];
     }
 
     template <typename M>
-    template <typename Iterator>
-    Iterator PAMCP<M>::findBestBonusA(Iterator begin, Iterator end, unsigned count) {
+    size_t PAMCP<M>::findBestBonusA(const Stat * stats, size_t ranks, unsigned count, size_t width) const {
+      const Stat * V = stats, * N = stats + ranks, * VL = N + ranks;
       // Count here can be as low as 1.
       // Since log(1) = 0, and 0/0 = error, we add 1.0.
-      double logCount = std::log(count + 1.0);
-      // We use this function to produce a score for each action. This can be easily
-      // substituted with something else to produce different POMCP variants.
-      auto evaluationFunction = [this, logCount](const ActionNode & an){
-	return an.V + exploration_ * std::sqrt( logCount / an.N );
-      };
-
-      auto bestIterator = begin++;
-      double bestValue = evaluationFunction(*bestIterator);
+      double logCount = (count < logTable_.size() ? logTable_[count] : std::log(count + 1.0));
+      const double inf = std::numeric_limits<double>::infinity();
+      // Other threads may be updating the stats: they are read with relaxed loads.
+      auto load = [](const Stat * s, size_t a) { return s[a].value.load(std::memory_order_relaxed); };
 
-      for ( ; begin < end; ++begin ) {
-	double actionValue = evaluationFunction(*begin);
-	if ( actionValue > bestValue ) {
-	  bestValue = actionValue;
-	  bestIterator = begin;
+      // We use UCT to produce a score for each action. This can be easily
+      // substituted with something else to produce different POMCP variants.
+      // Pending simulations (virtual loss) count as visits returning -virtualLoss_.
+      size_t a = 0, best = 0;
+      double bestValue = -inf;
+#if defined(__AVX512F__) || defined(__AVX2__)
+      {
+#if defined(__AVX512F__)
+	const size_t W = 8;
+#else
+	const size_t W = 4;
+#endif
+	double v[W], n[W], vl[W], values[W], indices[W];
+	std::fill(values, values + W, -inf);
+	std::fill(indices, indices + W, 0.0);
+#if defined(__AVX512F__)
+	const __m512d zero = _mm512_setzero_pd(), c = _mm512_set1_pd(exploration_), lc = _mm512_set1_pd(logCount), loss = _mm512_set1_pd(virtualLoss_);
+	__m512d bestV = _mm512_set1_pd(-inf), bestI = _mm512_setzero_pd(), idx = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+	for ( ; a + W <= width; a += W ) {
+	  for (size_t k = 0; k < W; ++k) { v[k] = load(V, a + k); n[k] = load(N, a + k); vl[k] = load(VL, a + k); }
+	  __m512d sv = _mm512_loadu_pd(v), sn = _mm512_loadu_pd(n), svl = _mm512_loadu_pd(vl);
+	  __m512d total = _mm512_add_pd(sn, svl);
+	  __mmask8 pending = _mm512_cmp_pd_mask(svl, zero, _CMP_GT_OQ);
+	  sv = _mm512_mask_div_pd(sv, pending, _mm512_sub_pd(_mm512_mul_pd(sv, sn), _mm512_mul_pd(loss, svl)), total);
+	  __m512d score = _mm512_add_pd(sv, _mm512_mul_pd(c, _mm512_sqrt_pd(_mm512_div_pd(lc, total))));
+	  score = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(total, zero, _CMP_EQ_OQ), score, _mm512_set1_pd(inf));
+	  __mmask8 better = _mm512_cmp_pd_mask(score, bestV, _CMP_GT_OQ);
+	  bestV = _mm512_mask_blend_pd(better, bestV, score);
+	  bestI = _mm512_mask_blend_pd(better, bestI, idx);
+	  idx = _mm512_add_pd(idx, _mm512_set1_pd(W));
+	}
+	_mm512_storeu_pd(values, bestV);
+	_mm512_storeu_pd(indices, bestI);
+#else
+	const __m256d zero = _mm256_setzero_pd(), c = _mm256_set1_pd(exploration_), lc = _mm256_set1_pd(logCount), loss = _mm256_set1_pd(virtualLoss_);
+	__m256d bestV = _mm256_set1_pd(-inf), bestI = _mm256_setzero_pd(), idx = _mm256_set_pd(3, 2, 1, 0);
+	for ( ; a + W <= width; a += W ) {
+	  for (size_t k = 0; k < W; ++k) { v[k] = load(V, a + k); n[k] = load(N, a + k); vl[k] = load(VL, a + k); }
+	  __m256d sv = _mm256_loadu_pd(v), sn = _mm256_loadu_pd(n), svl = _mm256_loadu_pd(vl);
+	  __m256d total = _mm256_add_pd(sn, svl);
+	  __m256d pending = _mm256_cmp_pd(svl, zero, _CMP_GT_OQ);
+	  sv = _mm256_blendv_pd(sv, _mm256_div_pd(_mm256_sub_pd(_mm256_mul_pd(sv, sn), _mm256_mul_pd(loss, svl)), total), pending);
+	  __m256d score = _mm256_add_pd(sv, _mm256_mul_pd(c, _mm256_sqrt_pd(_mm256_div_pd(lc, total))));
+	  score = _mm256_blendv_pd(score, _mm256_set1_pd(inf), _mm256_cmp_pd(total, zero, _CMP_EQ_OQ));
+	  __m256d better = _mm256_cmp_pd(score, bestV, _CMP_GT_OQ);
+	  bestV = _mm256_blendv_pd(bestV, score, better);
+	  bestI = _mm256_blendv_pd(bestI, idx, better);
+	  idx = _mm256_add_pd(idx, _mm256_set1_pd(W));
+	}
+	_mm256_storeu_pd(values, bestV);
+	_mm256_storeu_pd(indices, bestI);
+#endif
+	// Each lane holds its first best action: keep the first of the best lanes
+	for (size_t k = 0; k < W; ++k) {
+	  if ( values[k] > bestValue || (values[k] == bestValue && indices[k] < best) ) {
+	    bestValue = values[k];
+	    best = indices[k];
+	  }
+	}
+      }
+#endif
+      for ( ; a < width; ++a ) {
+	double n = load(N, a), vl = load(VL, a), v = load(V, a), score = inf;
+	if ( n + vl > 0 ) {
+	  if ( vl ) v = (v * n - virtualLoss_ * vl) / (n + vl);
+	  score = v + exploration_ * std::sqrt( logCount / (n + vl) );
+	}
+	if ( score > bestValue ) {
+	  bestValue = score;
+	  best = a;
 	}
       }
+      return best;
+    }
 
-      return bestIterator;
+    template <typename M>
+    void PAMCP<M>::computeLogTable() {
+      // Counts carried over from previous searches may exceed the table, these use std::log.
+      logTable_.resize(std::min<size_t>(iterations_, 1 << 20) + 2);
+      for (size_t n = 0; n < logTable_.size(); ++n) {
+	logTable_[n] = std::log(n + 1.0);
+      }
     }
 
     template <typename M>
-    typename PAMCP<M>::SampleBelief PAMCP<M>::makeSampledBelief(const Belief & b, size_t o) {
+    typename PAMCP<M>::SampleBelief PAMCP<M>::makeSampledBelief(const Belief & b) {
       SampleBelief belief;
-      belief.reserve(beliefSize_);
       model_.bottleneck_call();
       for ( size_t i = 0; i < beliefSize_; ++i )
-	belief.push_back(sampleProbability(E, b, rand_) * O + o);
+	belief.add(sampleProbability(E, b, rand_), E);
 
       return belief;
     }
@@ -546,9 +3156,15 @@ namespace AIToolbox {
       beliefSize_ = beliefSize;
     }
 
+    template <typename M>
+    void PAMCP<M>::setParticleCap(unsigned particles) {
+      particleCap_ = particles;
+    }
+
     template <typename M>
     void PAMCP<M>::setIterations(unsigned iter) {
       iterations_ = iter;
+      computeLogTable();
     }
 
     template <typename M>
@@ -556,6 +3172,201 @@ namespace AIToolbox {
       exploration_ = exp;
     }
 
+    template <typename M>
+    void PAMCP<M>::setThreads(unsigned threads, bool shared_tree /* false */) {
+      threads_ = std::max(1u, threads);
+      sharedTree_ = shared_tree && threads_ > 1;
+      workers_.clear();
+      for (unsigned i = 1; i < threads_; ++i) workers_.emplace_back(treeBase_);
+      locks_ = Locks(sharedTree_ ? 1024 : 0);
+    }
+
+    template <typename M>
+    void PAMCP<M>::setVirtualLoss(double vl) {
+      virtualLoss_ = vl;
+    }
+
+    template <typename M>
+    void PAMCP<M>::setRolloutBatch(unsigned n) {
+      rolloutBatch_ = std::max(1u, n);
+    }
+
+    template <typename M>
+    void PAMCP<M>::setLeafEvaluation(bool mdp, unsigned horizon /* 0 */) {
+      mdpLeaves_ = mdp;
+      if (mdpLeaves_) solveLeafValues(horizon);
+    }
+
+    template <typename M>
+    void PAMCP<M>::setRolloutPolicy(const std::vector<double> & weights) {
+      rolloutRows_ = weights.size() / A;
+      assert(("Rollout policy rows must be per observation or per state", !rolloutRows_ || rolloutRows_ == O || rolloutRows_ == S));
+      rolloutProb_.resize(weights.size());
+      rolloutAlias_.resize(weights.size());
+      for (size_t row = 0; row < rolloutRows_; ++row)
+	buildAlias(&weights[row * A], A, &rolloutProb_[row * A], &rolloutAlias_[row * A]);
+    }
+
+    template <typename M>
+    void PAMCP<M>::setIdentifiedPolicy(double threshold, unsigned horizon) {
+      assert(("Unvalid identification threshold", threshold >= 0 && threshold < 1));
+      assert(("The identified policy needs a horizon", threshold == 0 || horizon > 0));
+      identifiedThreshold_ = threshold;
+      if (threshold == 0) return;
+      solveLeafValues(horizon - 1);
+      const double * next = &leafValues_[(horizon - 1) * S];
+      identifiedQ_.resize(S * A);
+      identifiedPolicy_.resize(S);
+      for (size_t s = 0; s < S; ++s) {
+	std::vector<size_t> successors = successorStates(s);
+	for (size_t a = 0; a < A; ++a) identifiedQ_[s * A + a] = mdpQValue(s, a, successors, next);
+	identifiedPolicy_[s] = std::max_element(&identifiedQ_[s * A], &identifiedQ_[s * A] + A) - &identifiedQ_[s * A];
+      }
+    }
+
+    template <typename M>
+    void PAMCP<M>::setStratifiedRoot(bool stratified) {
+      stratifiedRoot_ = stratified;
+    }
+
+    template <typename M>
+    void PAMCP<M>::setProgressiveWidening(double c, double alpha /* 0.5 */) {
+      wideningC_ = c;
+      wideningAlpha_ = alpha;
+      // Rankings depend on the rollout policy: they are computed again
+      orderIndex_ = std::vector<Slot>(wideningC_ > 0 ? O : 0);
+      orders_.clear();
+    }
+
+    template <typename M>
+    void PAMCP<M>::setTranspositions(unsigned levels) {
+      assert(("Transpositions require exact beliefs", !levels || with_exact_belief));
+      transpositionLevels_ = levels;
+    }
+
+    template <typename M>
+    void PAMCP<M>::setBeliefSupport(double threshold, unsigned k /* 0 */) {
+      assert(("The belief support requires exact beliefs", (threshold == 0 && !k) || with_exact_belief));
+      assert(("Unvalid belief support threshold", threshold >= 0 && threshold < 1));
+      supportThreshold_ = threshold;
+      supportSize_ = k;
+      support_.clear();
+      residual_ = 0.0;
+    }
+
+    template <typename M>
+    void PAMCP<M>::setEnvironmentClusters(double threshold) {
+      assert(("Environment clusters require exact beliefs", threshold == 0 || with_exact_belief));
+      assert(("Unvalid cluster threshold", threshold >= 0 && threshold < 1));
+      clusterThreshold_ = threshold;
+      if (threshold > 0 && E > 1 && clusters_.empty()) buildClusters();
+      support_.clear();
+      residual_ = 0.0;
+    }
+
+    template <typename M>
+    void PAMCP<M>::setOpeningBook(unsigned depth, unsigned levels /* 100 */, unsigned simulations /* 0 */, unsigned refresh /* 0 */) {
+      assert(("The opening book requires exact beliefs", !depth || with_exact_belief));
+      assert(("Unvalid opening book quantization", levels > 0));
+      if (levels != bookLevels_) book_.clear();
+      bookDepth_ = depth;
+      bookLevels_ = levels;
+      bookSimulations_ = simulations;
+      bookRefresh_ = refresh;
+    }
+
+    template <typename M>
+    bool PAMCP<M>::warmOpeningBook(const Belief & be, size_t o, unsigned horizon) {
+      assert(("The opening book is disabled", bookDepth_ > 0));
+      if ( !horizon ) return false;
+      double needed = (bookSimulations_ ? bookSimulations_ : iterations_), visits = -1.0;
+      // The entry grows with every search, the loop stops as soon as one does not add to it
+      while (true) {
+	sampleAction(be, o, horizon, true);
+	if (booked_) return true;
+	if (identifiedEnv_ != NONE) return false;
+	double now = bookVisits(bookKey());
+	if (now >= needed) return true;
+	if (now <= visits) return false;
+	visits = now;
+      }
+    }
+
+    template <typename M>
+    void PAMCP<M>::saveOpeningBook(const std::string & path) const {
+      std::ofstream out(path);
+      out.precision(17);
+      out << bookLevels_ << " " << A << "\n";
+      for (auto & it : book_) {
+	out << it.first << " " << it.second.hits;
+	for (size_t a = 0; a < A; ++a) out << " " << it.second.V[a];
+	for (size_t a = 0; a < A; ++a) out << " " << it.second.N[a];
+	out << "\n";
+      }
+    }
+
+    template <typename M>
+    bool PAMCP<M>::loadOpeningBook(const std::string & path) {
+      std::ifstream in(path);
+      if (!in) return false;
+      unsigned levels; size_t actions;
+      in >> levels >> actions;
+      assert(("Opening book written for another model", actions == A));
+      assert(("Opening book written with another quantization", levels == bookLevels_));
+      uint64_t key;
+      BookEntry entry;
+      entry.V.resize(A);
+      entry.N.resize(A);
+      while (in >> key >> entry.hits) {
+	for (size_t a = 0; a < A; ++a) in >> entry.V[a];
+	for (size_t a = 0; a < A; ++a) in >> entry.N[a];
+	auto & mine = book_[key];
+	if (mine.V.empty()) {
+	  mine = entry;
+	  continue;
+	}
+	mine.hits += entry.hits;
+	for (size_t a = 0; a < A; ++a) {
+	  double n = mine.N[a] + entry.N[a];
+	  if (n > 0) mine.V[a] = (mine.V[a] * mine.N[a] + entry.V[a] * entry.N[a]) / n;
+	  mine.N[a] = n;
+	}
+      }
+      return true;
+    }
+
+    template <typename M>
+    void PAMCP<M>::setMemoryBudget(size_t bytes) {
+      memoryBudget_ = bytes;
+    }
+
+    template <typename M>
+    void PAMCP<M>::setTimeBudget(double ms) {
+      timeBudget_ = ms;
+    }
+
+    template <typename M>
+    void PAMCP<M>::setPondering(unsigned simulations) {
+      stopPondering();
+      ponderSimulations_ = simulations;
+    }
+
+    template <typename M>
+    void PAMCP<M>::setEarlyStop(double delta, unsigned interval /* 100 */) {
+      assert(("Unvalid early stopping confidence", delta >= 0 && delta < 1));
+      stopDelta_ = delta;
+      stopInterval_ = std::max(1u, interval);
+    }
+
+    template <typename M>
+    void PAMCP<M>::setBudgetSchedule(double floor, unsigned sessionBudget /* 0 */) {
+      assert(("Unvalid budget floor", floor >= 0 && floor <= 1));
+      budgetFloor_ = floor;
+      sessionBudget_ = sessionBudget;
+      sumWeights_ = 0.0;
+      nWeights_ = 0;
+    }
+
     template <typename M>
     const M& PAMCP<M>::getModel() const {
       return model_;
@@ -563,29 +3374,49 @@ namespace AIToolbox {
 
     template <typename M>
     const std::vector<double> PAMCP<M>::getEnvBelief() const {
+      std::lock_guard<std::mutex> lock(ponder_.m);
       std::vector<double> scores(E);
+      auto & root = graph_.beliefs[graph_.root];
       if (with_exact_belief) {
 	for (int i = 0; i < E; i++) {
-	  scores.at(i) = graph_.envbelief(i);
+	  scores.at(i) = rootProbability(i);
 	}
       } else {
-	for (auto it = begin(graph_.smplbelief); it != end(graph_.smplbelief); ++it) {
-	  scores.at(model_.get_env(*it))++;
-	}
+	root.smplbelief.forEach([&scores](size_t e, uint32_t n) { scores.at(e) = n; });
       }
       return scores;
     }
 
     template <typename M>
-    const typename PAMCP<M>::BeliefNode& PAMCP<M>::getGraph() const {
+    const typename PAMCP<M>::Tree& PAMCP<M>::getGraph() const {
       return graph_;
     }
 
+    template <typename M>
+    std::vector<double> PAMCP<M>::getActionScores() const {
+      std::lock_guard<std::mutex> lock(ponder_.m);
+      auto & root = graph_.beliefs[graph_.root];
+      if (identifiedEnv_ != NONE) {
+	auto q = identifiedQ_.begin() + (identifiedEnv_ * O + root.obs) * A;
+	return std::vector<double>(q, q + A);
+      }
+      std::vector<double> scores(A);
+      for (size_t r = 0; r < A; r++) {
+	scores.at(actionOf(root.obs, r)) = graph_.stats[root.actions + r].value;
+      }
+      return scores;
+    }
+
     template <typename M>
     size_t PAMCP<M>::getBeliefSize() const {
       return beliefSize_;
     }
 
+    template <typename M>
+    unsigned PAMCP<M>::getParticleCap() const {
+      return particleCap_;
+    }
+
     template <typename M>
     unsigned PAMCP<M>::getIterations() const {
       return iterations_;
@@ -595,6 +3426,115 @@ namespace AIToolbox {
     double PAMCP<M>::getExploration() const {
       return exploration_;
     }
+
+    template <typename M>
+    unsigned PAMCP<M>::getThreads() const {
+      return threads_;
+    }
+
+    template <typename M>
+    bool PAMCP<M>::getSharedTree() const {
+      return sharedTree_;
+    }
+
+    template <typename M>
+    double PAMCP<M>::getVirtualLoss() const {
+      return virtualLoss_;
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::getRolloutBatch() const {
+      return rolloutBatch_;
+    }
+
+    template <typename M>
+    bool PAMCP<M>::getLeafEvaluation() const {
+      return mdpLeaves_;
+    }
+
+    template <typename M>
+    bool PAMCP<M>::getStratifiedRoot() const {
+      return stratifiedRoot_;
+    }
+
+    template <typename M>
+    double PAMCP<M>::getProgressiveWidening() const {
+      return wideningC_;
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::getTranspositions() const {
+      return transpositionLevels_;
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::getBeliefSupport() const {
+      return support_.empty() ? E : support_.size();
+    }
+
+    template <typename M>
+    double PAMCP<M>::getResidualMass() const {
+      return residual_;
+    }
+
+    template <typename M>
+    double PAMCP<M>::getEnvironmentClusters() const {
+      return clusterThreshold_;
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::getOpeningBook() const {
+      return bookDepth_;
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::getOpeningBookSize() const {
+      return book_.size();
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::getMemoryBudget() const {
+      return memoryBudget_;
+    }
+
+    template <typename M>
+    size_t PAMCP<M>::getMemoryUsage() const {
+      std::lock_guard<std::mutex> lock(ponder_.m);
+      size_t bytes = treeBytes(graph_) + treeBytes(scratch_) + likelihoodIndex_.size() * sizeof(Slot) + likelihoods_.size() * sizeof(double) + orders_.size() * sizeof(uint32_t);
+      for (auto & w : workers_) bytes += treeBytes(w.tree);
+      bytes += book_.size() * (sizeof(std::pair<uint64_t, BookEntry>) + 3 * sizeof(void*) + 2 * A * sizeof(double));
+      return bytes;
+    }
+
+    template <typename M>
+    double PAMCP<M>::getTimeBudget() const {
+      return timeBudget_;
+    }
+
+    template <typename M>
+    double PAMCP<M>::getIdentifiedThreshold() const {
+      return identifiedThreshold_;
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::getBudget() const {
+      return budget_;
+    }
+
+    template <typename M>
+    double PAMCP<M>::getEarlyStop() const {
+      return stopDelta_;
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::getPondering() const {
+      return ponderSimulations_;
+    }
+
+    template <typename M>
+    unsigned PAMCP<M>::getSimulations() const {
+      return simulations_;
+    }
   }
 }
 
@@ -0,0 +1,232 @@
+#ifndef AI_TOOLBOX_POMDP_PARTICLECOUNTS_HEADER_FILE
+#define AI_TOOLBOX_POMDP_PARTICLECOUNTS_HEADER_FILE
+
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <cassert>
+
+namespace AIToolbox {
+  namespace POMDP {
+    /**
+     * @brief This class implements a particle belief as a histogram over environments.
+     *
+     * All the particles of a belief node share the observation of the
+     * node, so a particle is fully described by its environment. The
+     * histogram stores a count per environment, sparsely as (env,
+     * count) pairs while few environments are present, then densely
+     * as a Fenwick tree over the E environments. Adding, removing and
+     * sampling a particle are O(log E) in the dense form and
+     * O(SPARSE_MAX) in the sparse one, and the memory never exceeds
+     * O(E) whatever the number of particles.
+     *
+     * The number of environments is not stored: it is given to the
+     * functions that need it.
+     */
+    class ParticleCounts {
+    public:
+      /**
+       * @brief The maximal number of environments stored sparsely.
+       */
+      static constexpr size_t SPARSE_MAX = 16;
+
+      /**
+       * @brief Basic constructor, for an empty belief.
+       */
+      ParticleCounts() : total_(0), dense_(false) {}
+
+      /**
+       * @brief This function adds particles of an environment.
+       *
+       * @param e The environment of the particles.
+       * @param E The number of environments.
+       * @param n The number of particles.
+       */
+      void add(size_t e, size_t E, uint32_t n = 1);
+
+      /**
+       * @brief This function removes a particle of an environment present in the belief.
+       *
+       * @param e The environment of the particle.
+       */
+      void remove(size_t e);
+
+      /**
+       * @brief This function adds all the particles of another belief.
+       *
+       * @param other The belief to merge.
+       * @param E The number of environments.
+       */
+      void merge(const ParticleCounts & other, size_t E);
+
+      /**
+       * @brief This function samples the environment of a particle uniformly.
+       *
+       * @param rng The random engine to use.
+       *
+       * @return The environment of the sampled particle.
+       */
+      template <typename G>
+      size_t sample(G & rng) const;
+
+      /**
+       * @brief This function returns the number of particles of an environment.
+       *
+       * @param e The environment.
+       *
+       * @return The number of particles.
+       */
+      uint32_t count(size_t e) const;
+
+      /**
+       * @brief This function calls f(e, n) for each environment e with n > 0 particles.
+       */
+      template <typename F>
+      void forEach(F f) const;
+
+      /**
+       * @brief This function returns the number of particles.
+       *
+       * @return The total count.
+       */
+      size_t size() const { return total_; }
+
+      /**
+       * @brief This function returns the heap memory used by the belief.
+       *
+       * @return The number of bytes.
+       */
+      size_t bytes() const { return data_.capacity() * sizeof(uint32_t); }
+
+    private:
+      /**
+       * @brief This function switches to the dense form.
+       */
+      void densify(size_t E);
+
+      /**
+       * @brief This function adds delta to the count of e in the Fenwick tree.
+       */
+      void update(size_t e, uint32_t delta);
+
+      /**
+       * @brief This function returns the sum of the counts of the first e environments in the Fenwick tree.
+       */
+      uint32_t prefix(size_t e) const;
+
+      // Sparse: (env, count) pairs. Dense: Fenwick tree, data_[i - 1] for the 1-based node i.
+      std::vector<uint32_t> data_;
+      uint32_t total_;
+      bool dense_;
+    };
+
+    inline void ParticleCounts::add(size_t e, size_t E, uint32_t n /* 1 */) {
+      total_ += n;
+      if (dense_) {
+	update(e, n);
+	return;
+      }
+      for (size_t i = 0; i < data_.size(); i += 2) {
+	if (data_[i] == e) {
+	  data_[i + 1] += n;
+	  return;
+	}
+      }
+      // A new environment: the dense form is used once it is not larger
+      size_t k = data_.size() / 2 + 1;
+      if (k > SPARSE_MAX || 2 * k >= E) {
+	total_ -= n;
+	densify(E);
+	add(e, E, n);
+	return;
+      }
+      data_.push_back(e);
+      data_.push_back(n);
+    }
+
+    inline void ParticleCounts::remove(size_t e) {
+      assert(("Removing a missing particle", count(e) > 0));
+      --total_;
+      if (dense_) {
+	update(e, static_cast<uint32_t>(-1));
+	return;
+      }
+      for (size_t i = 0; i < data_.size(); i += 2) {
+	if (data_[i] != e) continue;
+	if (--data_[i + 1] == 0) {
+	  data_[i] = data_[data_.size() - 2];
+	  data_[i + 1] = data_.back();
+	  data_.resize(data_.size() - 2);
+	}
+	return;
+      }
+    }
+
+    inline void ParticleCounts::merge(const ParticleCounts & other, size_t E) {
+      other.forEach([this, E](size_t e, uint32_t n) { add(e, E, n); });
+    }
+
+    template <typename G>
+    size_t ParticleCounts::sample(G & rng) const {
+      assert(("Sampling an empty belief", total_ > 0));
+      uint32_t r = std::uniform_int_distribution<uint32_t>(0, total_ - 1)(rng);
+      if (!dense_) {
+	size_t i = 0;
+	while (r >= data_[i + 1]) {
+	  r -= data_[i + 1];
+	  i += 2;
+	}
+	return data_[i];
+      }
+      // Descend the Fenwick tree to the first environment whose prefix sum exceeds r
+      size_t pos = 0, step = 1;
+      while (2 * step <= data_.size()) step *= 2;
+      for ( ; step; step /= 2) {
+	if (pos + step <= data_.size() && data_[pos + step - 1] <= r) {
+	  pos += step;
+	  r -= data_[pos - 1];
+	}
+      }
+      return pos;
+    }
+
+    inline uint32_t ParticleCounts::count(size_t e) const {
+      if (dense_) return prefix(e + 1) - prefix(e);
+      for (size_t i = 0; i < data_.size(); i += 2)
+	if (data_[i] == e) return data_[i + 1];
+      return 0;
+    }
+
+    template <typename F>
+    void ParticleCounts::forEach(F f) const {
+      if (!dense_) {
+	for (size_t i = 0; i < data_.size(); i += 2) f(data_[i], data_[i + 1]);
+	return;
+      }
+      for (size_t e = 0; e < data_.size(); ++e) {
+	uint32_t n = count(e);
+	if (n) f(e, n);
+      }
+    }
+
+    inline void ParticleCounts::densify(size_t E) {
+      std::vector<uint32_t> sparse;
+      sparse.swap(data_);
+      data_.assign(E, 0);
+      dense_ = true;
+      for (size_t i = 0; i < sparse.size(); i += 2) update(sparse[i], sparse[i + 1]);
+    }
+
+    inline void ParticleCounts::update(size_t e, uint32_t delta) {
+      for (size_t i = e + 1; i <= data_.size(); i += i & (~i + 1)) data_[i - 1] += delta;
+    }
+
+    inline uint32_t ParticleCounts::prefix(size_t e) const {
+      uint32_t sum = 0;
+      for (size_t i = e; i > 0; i -= i & (~i + 1)) sum += data_[i - 1];
+      return sum;
+    }
+  }
+}
+
+#endif
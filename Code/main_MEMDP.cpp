@@ -19,7 +19,7 @@
 
 
 template <typename M>
-void mainMEMDP(M model, std::string datafile_base, std::string algo, int horizon, int steps, float epsilon, int beliefSize, float exp, bool precision, bool verbose, bool has_test) {
+void mainMEMDP(M model, std::string datafile_base, std::string algo, int horizon, int steps, float epsilon, int beliefSize, float exp, bool precision, bool verbose, bool has_test, unsigned int threads, bool shared_tree, double memory_budget, double time_budget, unsigned int rollout_batch, bool mdp_leaves, std::string rollout_policy, bool policy_per_env, double widening, unsigned int transpositions, unsigned int book_depth, std::string book_file, unsigned int ponder, unsigned int particle_cap, bool stratified, double early_stop, double budget_floor, unsigned int session_budget, double identified, double support_threshold, unsigned int support_size, double clusters, unsigned int think_time) {
   // Training
   double training_time, testing_time;
   auto start = std::chrono::high_resolution_clock::now();
@@ -46,17 +46,51 @@ void mainMEMDP(M model, std::string datafile_base, std::string algo, int horizon
     bool with_tree = !(algo.compare("pamcp") && algo.compare("pamcpex"));
     bool with_exact_belief = !(algo.compare("pamcpex") && algo.compare("pomcpex"));
     AIToolbox::POMDP::PAMCP<decltype(model)> solver( model, beliefSize, steps, exp, with_tree, with_exact_belief);
+    solver.setThreads(threads, shared_tree);
+    solver.setMemoryBudget(memory_budget * 1048576);
+    solver.setTimeBudget(time_budget);
+    solver.setRolloutBatch(rollout_batch);
+    solver.setLeafEvaluation(mdp_leaves, horizon);
+    if (rollout_policy.compare("none")) {
+      solver.setRolloutPolicy(load_action_counts(rollout_policy, model.getO(), model.getA(), (policy_per_env ? model.getE() : 0)));
+    }
+    solver.setProgressiveWidening(widening);
+    solver.setPondering(ponder);
+    solver.setParticleCap(particle_cap);
+    solver.setEarlyStop(early_stop);
+    solver.setBudgetSchedule(budget_floor, session_budget);
+    solver.setIdentifiedPolicy(identified, horizon);
+    if (with_exact_belief) {
+      solver.setTranspositions(transpositions);
+      solver.setOpeningBook(book_depth);
+      solver.setStratifiedRoot(stratified);
+      solver.setBeliefSupport(support_threshold, support_size);
+      solver.setEnvironmentClusters(clusters);
+      if (book_depth && book_file.compare("none") && solver.loadOpeningBook(book_file)) {
+	std::cout << current_time_str() << " - Loaded " << solver.getOpeningBookSize() << " opening book entries\n";
+      }
+      // The first decision of every session starts from the uniform belief
+      if (book_depth) {
+	AIToolbox::POMDP::Belief env_belief = AIToolbox::POMDP::Belief(model.getE());
+	env_belief.fill(1.0 / model.getE());
+	bool warm = solver.warmOpeningBook(env_belief, 0, horizon);
+	std::cout << current_time_str() << " - Opening book " << (warm ? "warmed" : "not warmed") << " for the initial belief\n";
+      }
+    }
     training_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count() / 1000000.;
     start = std::chrono::high_resolution_clock::now();
     std::cout << current_time_str() << " - Starting evaluation!\n" << std::flush;
     std::cout << std::flush;
     std::cerr << std::flush;
     if (has_test) {
-      evaluate_from_file(datafile_base + ".test", model, solver, horizon, verbose);
+      evaluate_from_file(datafile_base + ".test", model, solver, horizon, verbose, true, think_time);
     } else {
-      evaluate_interactive(5000, model, solver, horizon, verbose);
+      evaluate_interactive(5000, model, solver, horizon, verbose, false, 400, think_time);
     }
     testing_time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count() / 1000000.;
+    if (solver.getOpeningBook() && book_file.compare("none")) {
+      solver.saveOpeningBook(book_file);
+    }
   }
   // PBVI
   else if (!algo.compare("pbvi")) {
@@ -117,6 +151,43 @@ int main(int argc, char* argv[]) {
   assert(("Unvalid belief size", beliefSize >= 0));
   bool precision = ((argc > 10) ? (atoi(argv[10]) == 1) : false);
   bool verbose = ((argc > 11) ? (atoi(argv[11]) == 1) : false);
+  unsigned int threads = ((argc > 12) ? std::atoi(argv[12]) : 1);
+  assert(("Unvalid number of threads", threads > 0));
+  std::string parallel = ((argc > 13) ? argv[13] : "root");
+  assert(("Unvalid parallelization scheme", !(parallel.compare("root") && parallel.compare("tree"))));
+  bool shared_tree = !parallel.compare("tree");
+  double memory_budget = ((argc > 14) ? std::atof(argv[14]) : 0);
+  assert(("Unvalid memory budget", memory_budget >= 0));
+  double time_budget = ((argc > 15) ? std::atof(argv[15]) : 0);
+  assert(("Unvalid time budget", time_budget >= 0));
+  unsigned int rollout_batch = ((argc > 16) ? std::atoi(argv[16]) : 1);
+  assert(("Unvalid rollout batch size", rollout_batch > 0));
+  std::string leaves = ((argc > 17) ? argv[17] : "rollout");
+  assert(("Unvalid leaf evaluation", !(leaves.compare("rollout") && leaves.compare("mdp"))));
+  bool mdp_leaves = !leaves.compare("mdp");
+  std::string rollout_policy = ((argc > 18) ? argv[18] : "none");
+  bool policy_per_env = ((argc > 19) ? (atoi(argv[19]) == 1) : false);
+  double widening = ((argc > 20) ? std::atof(argv[20]) : 0);
+  assert(("Unvalid progressive widening constant", widening >= 0));
+  unsigned int transpositions = ((argc > 21) ? std::atoi(argv[21]) : 0);
+  unsigned int book_depth = ((argc > 22) ? std::atoi(argv[22]) : 0);
+  std::string book_file = ((argc > 23) ? argv[23] : "none");
+  unsigned int ponder = ((argc > 24) ? std::atoi(argv[24]) : 0);
+  unsigned int particle_cap = ((argc > 25) ? std::atoi(argv[25]) : 0);
+  bool stratified = ((argc > 26) ? (atoi(argv[26]) == 1) : false);
+  double early_stop = ((argc > 27) ? std::atof(argv[27]) : 0);
+  assert(("Unvalid early stopping confidence", early_stop >= 0 && early_stop < 1));
+  double budget_floor = ((argc > 28) ? std::atof(argv[28]) : 1);
+  assert(("Unvalid budget floor", budget_floor >= 0 && budget_floor <= 1));
+  unsigned int session_budget = ((argc > 29) ? std::atoi(argv[29]) : 0);
+  double identified = ((argc > 30) ? std::atof(argv[30]) : 0);
+  assert(("Unvalid identification threshold", identified >= 0 && identified < 1));
+  double support_threshold = ((argc > 31) ? std::atof(argv[31]) : 0);
+  assert(("Unvalid belief support threshold", support_threshold >= 0 && support_threshold < 1));
+  unsigned int support_size = ((argc > 32) ? std::atoi(argv[32]) : 0);
+  double clusters = ((argc > 33) ? std::atof(argv[33]) : 0);
+  assert(("Unvalid cluster threshold", clusters >= 0 && clusters < 1));
+  unsigned int think_time = ((argc > 34) ? std::atoi(argv[34]) : 0);
 
   // Create model
   std::string datafile_base = std::string(argv[1]);
@@ -125,7 +196,7 @@ int main(int argc, char* argv[]) {
     Recomodel model (datafile_base + ".summary", discount, false);
     model.load_rewards(datafile_base + ".rewards");
     model.load_transitions(datafile_base + ".transitions", precision, precision, datafile_base + ".profiles");
-    mainMEMDP(model, datafile_base, algo, horizon, steps, epsilon, beliefSize, exp, precision, verbose, true);
+    mainMEMDP(model, datafile_base, algo, horizon, steps, epsilon, beliefSize, exp, precision, verbose, true, threads, shared_tree, memory_budget, time_budget, rollout_batch, mdp_leaves, rollout_policy, policy_per_env, widening, transpositions, book_depth, book_file, ponder, particle_cap, stratified, early_stop, budget_floor, session_budget, identified, support_threshold, support_size, clusters, think_time);
   } else if (!data.compare("maze")) {
     if (discount < 1) {
       std::cout << "Setting undiscounted model";
@@ -134,7 +205,7 @@ int main(int argc, char* argv[]) {
     Mazemodel model(datafile_base + ".summary", discount);
     model.load_rewards(datafile_base + ".rewards");
     model.load_transitions(datafile_base + ".transitions", precision, precision, verbose);
-    mainMEMDP(model, datafile_base, algo, horizon, steps, epsilon, beliefSize, exp, precision, verbose, false);
+    mainMEMDP(model, datafile_base, algo, horizon, steps, epsilon, beliefSize, exp, precision, verbose, false, threads, shared_tree, memory_budget, time_budget, rollout_batch, mdp_leaves, rollout_policy, policy_per_env, widening, transpositions, book_depth, book_file, ponder, particle_cap, stratified, early_stop, budget_floor, session_budget, identified, support_threshold, support_size, clusters, think_time);
   }
   return 0;
 
@@ -0,0 +1,275 @@
+/* ---------------------------------------------------------------------------
+** main_inspect.cpp
+** This file contains the routine to load a MEMDP model and report its memory
+** footprint and structure (sparsity, redundancy across environments, fan-out)
+** without running any solver.
+**
+** Author: Amelie Royer
+** Email: amelie.royer@ist.ac.at
+** -------------------------------------------------------------------------*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include "mazemodel.hpp"
+#include "recomodel.hpp"
+
+
+/*! \brief Returns a human-readable representation of a number of bytes.
+ */
+std::string bytes_to_string(double bytes) {
+  const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+  int u = 0;
+  while (bytes >= 1024. && u < 4) {
+    bytes /= 1024.;
+    u++;
+  }
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision((u == 0) ? 0 : 2) << bytes << " " << units[u];
+  return ss.str();
+}
+
+/*! \brief Returns the resident memory of the current process in bytes, or 0 if unavailable.
+ */
+size_t resident_memory() {
+  std::ifstream infile("/proc/self/status");
+  std::string line;
+  while (std::getline(infile, line)) {
+    if (!line.compare(0, 6, "VmRSS:")) {
+      std::istringstream iss(line.substr(6));
+      size_t kb;
+      iss >> kb;
+      return kb * 1024;
+    }
+  }
+  return 0;
+}
+
+/*! \brief Returns the number of bytes needed to store a link index for rows of the given length.
+ */
+size_t link_index_bytes(size_t row_length) {
+  return ((row_length <= 256) ? 1 : ((row_length <= 65536) ? 2 : 4));
+}
+
+/*! \brief Prints a histogram given the buckets lower bounds, their counts and the maximum value.
+ */
+void print_histogram(const std::vector<size_t> &bounds, const std::vector<size_t> &counts, size_t max_value, size_t total) {
+  for (size_t i = 0; i < bounds.size(); i++) {
+    if (!counts.at(i)) { continue; }
+    size_t upper = ((i + 1 == bounds.size()) ? max_value : bounds.at(i + 1) - 1);
+    std::stringstream bucket;
+    if (upper == bounds.at(i)) {
+      bucket << bounds.at(i);
+    } else {
+      bucket << bounds.at(i) << "-" << upper;
+    }
+    std::cout << "      " << std::setw(12) << bucket.str() << " : " << std::setw(10) << counts.at(i)
+	      << "  (" << std::fixed << std::setprecision(2) << 100. * counts.at(i) / total << "%)\n";
+  }
+}
+
+/*! \brief Builds power-of-two histogram buckets 0, 1, 2, 3-4, 5-8, ... covering [0, max_value].
+ */
+std::vector<size_t> make_buckets(size_t max_value) {
+  std::vector<size_t> bounds {0, 1};
+  size_t b = 2;
+  while (b <= max_value) {
+    bounds.push_back(b);
+    b = ((b == 2) ? 3 : 2 * b - 1);
+  }
+  return bounds;
+}
+
+/*! \brief Returns the bucket index of v given sorted lower bounds.
+ */
+size_t find_bucket(const std::vector<size_t> &bounds, size_t v) {
+  return std::upper_bound(bounds.begin(), bounds.end(), v) - bounds.begin() - 1;
+}
+
+/*! \brief Loads the given model and prints its footprint and structure.
+ *
+ * \param model the MEMDP model to inspect.
+ * \param verbose if true, also outputs per-environment statistics.
+ */
+template <typename M>
+void inspect(const M& model, bool verbose) {
+  size_t E = model.getE(), O = model.getO(), A = model.getA(), L = model.get_row_length();
+
+  //********** Memory footprint
+  std::cout << "\n> Memory footprint ----------------\n";
+  size_t total_bytes = 0;
+  std::vector<std::pair<std::string, size_t> > footprint = model.memory_footprint();
+  for (auto it = footprint.begin(); it != footprint.end(); ++it) {
+    std::cout << "      > " << std::setw(20) << std::left << it->first << std::right << bytes_to_string(it->second) << "\n";
+    total_bytes += it->second;
+  }
+  std::cout << "      > " << std::setw(20) << std::left << "total" << std::right << bytes_to_string(total_bytes) << "\n";
+  size_t rss = resident_memory();
+  if (rss > 0) {
+    std::cout << "      > " << std::setw(20) << std::left << "process resident" << std::right << bytes_to_string(rss) << "\n";
+  }
+
+  //********** Row sparsity
+  size_t n_rows = 0, n_nnz = 0, n_empty = 0;
+  std::vector<size_t> row_bounds = make_buckets(L);
+  std::vector<size_t> row_counts(row_bounds.size(), 0);
+  std::vector<double> env_nnz(E, 0.);
+  std::vector<size_t> dead_states(E, 0);
+  // Unique rows across the whole tensor (hash -> representatives)
+  std::unordered_map<size_t, std::vector<const double*> > unique_rows;
+  size_t n_unique = 0, n_unique_nnz = 0;
+  // Redundancy across environments for a fixed (observation, action)
+  size_t n_env_duplicates = 0, n_shared_pairs = 0, n_pairs = 0;
+  size_t row_bytes = L * sizeof(double);
+  std::hash<std::string> hasher;
+
+  for (size_t o = 0; o < O; o++) {
+    std::vector<bool> has_mass(E, false), stored(E, false);
+    for (size_t a = 0; a < A; a++) {
+      std::vector<const double*> env_rows;
+      for (size_t e = 0; e < E; e++) {
+	const double* row = model.transition_row(e, o, a);
+	if (row == nullptr) { continue; }
+	stored.at(e) = true;
+	env_rows.push_back(row);
+	// Sparsity
+	size_t nnz = std::count_if(row, row + L, [](double p) { return p > 0.; });
+	n_rows++;
+	n_nnz += nnz;
+	env_nnz.at(e) += nnz;
+	row_counts.at(find_bucket(row_bounds, nnz))++;
+	if (nnz == 0) { n_empty++; } else { has_mass.at(e) = true; }
+	// Global duplicates
+	auto & candidates = unique_rows[hasher(std::string((const char*)row, row_bytes))];
+	if (std::none_of(candidates.begin(), candidates.end(), [row, row_bytes](const double* r) { return !memcmp(r, row, row_bytes); })) {
+	  candidates.push_back(row);
+	  n_unique++;
+	  n_unique_nnz += nnz;
+	}
+      }
+      // Duplicates across environments
+      if (env_rows.empty()) { continue; }
+      n_pairs++;
+      size_t distinct = 0;
+      for (size_t i = 0; i < env_rows.size(); i++) {
+	bool seen = false;
+	for (size_t j = 0; j < i && !seen; j++) {
+	  seen = !memcmp(env_rows.at(i), env_rows.at(j), row_bytes);
+	}
+	if (!seen) { distinct++; }
+      }
+      n_env_duplicates += env_rows.size() - distinct;
+      if (distinct == 1) { n_shared_pairs++; }
+    }
+    // States that can never be left (e.g. maze walls)
+    for (size_t e = 0; e < E; e++) {
+      if (stored.at(e) && !has_mass.at(e)) { dead_states.at(e)++; }
+    }
+  }
+
+  std::cout << "\n> Transition rows ----------------\n";
+  std::cout << "      > " << n_rows << " stored rows of " << L << " entries\n";
+  std::cout << "      > " << n_nnz << " non-zero entries (density " << std::fixed << std::setprecision(4) << (double)n_nnz / (n_rows * L) << ", "
+	    << std::setprecision(2) << (double)n_nnz / n_rows << " per row)\n";
+  std::cout << "      > " << n_empty << " empty rows\n";
+  std::cout << "      > non-zero entries per row:\n";
+  print_histogram(row_bounds, row_counts, L, n_rows);
+  if (verbose) {
+    for (size_t e = 0; e < E; e++) {
+      std::cout << "      > env " << e << ": " << std::setprecision(2) << env_nnz.at(e) / (n_rows / E) << " non-zero entries per row\n";
+    }
+  }
+
+  std::cout << "\n> Redundancy across environments ----------------\n";
+  std::cout << "      > " << n_unique << " unique rows (" << std::setprecision(2) << 100. * n_unique / n_rows << "% of stored rows)\n";
+  std::cout << "      > " << n_env_duplicates << " rows duplicate another environment's row for the same (observation, action) ("
+	    << 100. * n_env_duplicates / n_rows << "%)\n";
+  std::cout << "      > " << n_shared_pairs << " / " << n_pairs << " (observation, action) pairs are identical in all environments\n";
+
+  //********** States
+  std::cout << "\n> States ----------------\n";
+  size_t n_dead = std::accumulate(dead_states.begin(), dead_states.end(), (size_t)0);
+  size_t n_initial = 0, n_terminal = 0;
+  size_t max_fanout = 0, total_fanout = 0, min_fanout = model.getS();
+  std::vector<size_t> fanouts(model.getS());
+  for (size_t s = 0; s < model.getS(); s++) {
+    if (model.isInitial(s)) { n_initial++; }
+    if (model.isTerminal(s)) { n_terminal++; }
+    fanouts.at(s) = model.reachable_states(s).size();
+    total_fanout += fanouts.at(s);
+    max_fanout = std::max(max_fanout, fanouts.at(s));
+    min_fanout = std::min(min_fanout, fanouts.at(s));
+  }
+  std::cout << "      > " << n_initial << " initial states, " << n_terminal << " terminal states\n";
+  std::cout << "      > " << n_dead << " unreachable (wall) states, " << std::setprecision(2) << (double)n_dead / E << " per environment\n";
+  if (verbose) {
+    for (size_t e = 0; e < E; e++) {
+      std::cout << "      > env " << e << ": " << dead_states.at(e) << " unreachable states\n";
+    }
+  }
+  std::cout << "      > successor fan-out: min " << min_fanout << ", mean " << (double)total_fanout / model.getS() << ", max " << max_fanout << "\n";
+  std::vector<size_t> fan_bounds = make_buckets(max_fanout);
+  std::vector<size_t> fan_counts(fan_bounds.size(), 0);
+  for (auto it = fanouts.begin(); it != fanouts.end(); ++it) {
+    fan_counts.at(find_bucket(fan_bounds, *it))++;
+  }
+  print_histogram(fan_bounds, fan_counts, max_fanout, model.getS());
+
+  //********** Projected storage for the transition tensor
+  size_t idx = link_index_bytes(L);
+  size_t offsets = (n_rows + 1) * sizeof(uint32_t);
+  size_t unique_offsets = (n_unique + 1) * sizeof(uint32_t);
+  size_t row_table = n_rows * sizeof(uint32_t);
+  std::vector<std::pair<std::string, size_t> > options {
+    {"dense double (current)", n_rows * L * sizeof(double)},
+    {"dense float", n_rows * L * sizeof(float)},
+    {"sparse double", n_nnz * (sizeof(double) + idx) + offsets},
+    {"sparse float", n_nnz * (sizeof(float) + idx) + offsets},
+    {"shared rows, dense double", n_unique * L * sizeof(double) + row_table},
+    {"shared rows, sparse double", n_unique_nnz * (sizeof(double) + idx) + unique_offsets + row_table},
+    {"shared rows, sparse float", n_unique_nnz * (sizeof(float) + idx) + unique_offsets + row_table},
+    {"MDP (averaged) dense double", n_rows / E * L * sizeof(double)}
+  };
+  std::cout << "\n> Projected transition storage ----------------\n";
+  for (auto it = options.begin(); it != options.end(); ++it) {
+    std::cout << "      > " << std::setw(30) << std::left << it->first << std::right << std::setw(12) << bytes_to_string(it->second)
+	      << "  (x" << std::setprecision(3) << (double)it->second / (n_rows * L * sizeof(double)) << ")\n";
+  }
+  std::cout << "\n";
+}
+
+
+/**
+ * MAIN ROUTINE
+ */
+int main(int argc, char* argv[]) {
+  // Parse input arguments
+  assert(("Usage: ./mainInspect file_basename data_mode [precision] [verbose]", argc >= 3));
+  std::string data = argv[2];
+  assert(("Unvalid data mode", !(data.compare("reco") && data.compare("maze"))));
+  bool precision = ((argc > 3) ? (atoi(argv[3]) == 1) : false);
+  bool verbose = ((argc > 4) ? (atoi(argv[4]) == 1) : false);
+
+  // Create model
+  std::string datafile_base = std::string(argv[1]);
+  std::cout << "\nLoading model " << datafile_base << "\n";
+  if (!data.compare("reco")) {
+    Recomodel model (datafile_base + ".summary", 0.95, false);
+    model.load_rewards(datafile_base + ".rewards");
+    model.load_transitions(datafile_base + ".transitions", precision, precision, datafile_base + ".profiles");
+    std::cerr << "\n";
+    inspect(model, verbose);
+  } else if (!data.compare("maze")) {
+    Mazemodel model(datafile_base + ".summary", 1.);
+    model.load_rewards(datafile_base + ".rewards");
+    model.load_transitions(datafile_base + ".transitions", precision, precision, verbose);
+    inspect(model, verbose);
+  }
+  return 0;
+}
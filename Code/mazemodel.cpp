@@ -537,6 +537,9 @@ void Mazemodel::load_transitions(std::string tfile, bool precision /* =false */,
       }
     }
   }
+  // Sampling tables
+  build_alias_tables(transition_matrix, n_environments * (n_observations - 3) * n_actions, n_links);
+
   // Print the resulting maze for debugging purposes
   if (verbose) {
     print_maze();
@@ -602,10 +605,18 @@ double Mazemodel::getExpectedReward(size_t s1, size_t a, size_t s2) const {
  * SAMPLESR
  */
 std::tuple<size_t, double> Mazemodel::sampleSR(size_t s, size_t a) const {
+  return sampleSR(s, a, generator);
+}
+
+/**
+ * SAMPLESR (given random engine)
+ */
+std::tuple<size_t, double> Mazemodel::sampleSR(size_t s, size_t a, std::default_random_engine &rng) const {
   // Start state
   if (get_rep(s) == S) {
     int env = get_env(s);
-    size_t s2 = starting_states.at(env).at(rand() % starting_states.at(env).size());
+    std::uniform_int_distribution<size_t> start_distribution(0, starting_states.at(env).size() - 1);
+    size_t s2 = starting_states.at(env).at(start_distribution(rng));
     double r = getExpectedReward(s, a, s2);
     return std::make_tuple(s2, r);
   }
@@ -617,14 +628,29 @@ std::tuple<size_t, double> Mazemodel::sampleSR(size_t s, size_t a) const {
   // Others
   else {
     // Sample random transition
-    std::discrete_distribution<int> distribution (&transition_matrix[index(get_env(s), get_rep(s), a, 0)], &transition_matrix[index(get_env(s), get_rep(s), a, n_links)]);
-    size_t link = distribution(generator);
+    size_t link = sample_link(index(get_env(s), get_rep(s), a, 0) / n_links, rng);
     size_t s2 = next_state(s, link);
     double r = getExpectedReward(s, a, s2);
     return std::make_tuple(s2, r);
   }
 }
 
+/**
+ * SAMPLE_BATCH
+ */
+void Mazemodel::sample_batch(size_t n, const size_t* s, const size_t* a, size_t* s2, double* r, std::default_random_engine &rng) const {
+  for (size_t i = 0; i < n; i++) {
+    // S and absorbing states are rare, they go through the generic path
+    size_t rep = get_rep(s[i]);
+    if (rep == S || rep == G || rep == T) {
+      std::tie(s2[i], r[i]) = sampleSR(s[i], a[i], rng);
+      continue;
+    }
+    s2[i] = next_state(s[i], sample_link(index(get_env(s[i]), rep, a[i], 0) / n_links, rng));
+    r[i] = getExpectedReward(s[i], a[i], s2[i]);
+  }
+}
+
 /**
  * ISTERMINAL
  */
@@ -701,7 +727,7 @@ std::vector<size_t> Mazemodel::reachable_states(size_t state) const {
   if (get_rep(state) == S) {
     return starting_states.at(get_env(state));
   } //Absorbing states
-  else if (get_rep(state) == G || get_rep(state == T)) {
+  else if (get_rep(state) == G || get_rep(state) == T) {
     std::vector<size_t> result(1);
     result.at(0) = state;
     return result;
@@ -723,3 +749,48 @@ std::vector<size_t> Mazemodel::reachable_states(size_t state) const {
     return aux;
   }
 }
+
+/**
+ * MEMORY_FOOTPRINT
+ */
+std::vector<std::pair<std::string, size_t> > Mazemodel::memory_footprint() const {
+  std::vector<std::pair<std::string, size_t> > footprint;
+  footprint.push_back(std::make_pair("transition_matrix", n_environments * (n_observations - 3) * n_actions * n_links * sizeof(double)));
+  footprint.push_back(std::make_pair("alias tables", alias_bytes()));
+  // Vectors of vectors: outer buffer + each inner buffer
+  size_t starting_bytes = starting_states.capacity() * sizeof(std::vector<size_t>);
+  for (auto it = starting_states.begin(); it != starting_states.end(); ++it) {
+    starting_bytes += it->capacity() * sizeof(size_t);
+  }
+  footprint.push_back(std::make_pair("starting_states", starting_bytes));
+  size_t goal_bytes = goal_states.capacity() * sizeof(std::vector<size_t>);
+  for (auto it = goal_states.begin(); it != goal_states.end(); ++it) {
+    goal_bytes += it->capacity() * sizeof(size_t);
+  }
+  footprint.push_back(std::make_pair("goal_states", goal_bytes));
+  // Estimate for std::map: one red-black tree node (3 pointers + color) per entry
+  size_t rewards_bytes = 0;
+  for (auto it = goal_rewards.begin(); it != goal_rewards.end(); ++it) {
+    rewards_bytes += 4 * sizeof(void*) + sizeof(*it) + it->second.capacity() * sizeof(double);
+  }
+  footprint.push_back(std::make_pair("goal_rewards", rewards_bytes));
+  return footprint;
+}
+
+/**
+ * GET_ROW_LENGTH
+ */
+size_t Mazemodel::get_row_length() const {
+  return n_links;
+}
+
+/**
+ * TRANSITION_ROW
+ */
+const double* Mazemodel::transition_row(size_t env, size_t o, size_t a) const {
+  // S->, G->G and T->T transitions are not stored
+  if (o == S || o == G || o == T) {
+    return nullptr;
+  }
+  return &transition_matrix[index(env, o, a, 0)];
+}
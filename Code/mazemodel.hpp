@@ -172,6 +172,28 @@ public:
    */
   std::tuple<size_t, double> sampleSR(size_t s,size_t a) const;
 
+  /*! \brief Sample a state and reward given an origin state and chosen action, using
+   * the given random engine (thread-safe with one engine per thread).
+   *
+   * \param s origin state.
+   * \param a chosen action.
+   * \param rng random engine.
+   *
+   * \return s2 such that s -a-> s2, and the associated reward R(s, a, s2).
+   */
+  std::tuple<size_t, double> sampleSR(size_t s, size_t a, std::default_random_engine &rng) const;
+
+  /*! \brief Sample a batch of states and rewards given origin states and chosen actions.
+   *
+   * \param n number of samples.
+   * \param s origin states.
+   * \param a chosen actions.
+   * \param s2 output sampled states.
+   * \param r output rewards.
+   * \param rng random engine.
+   */
+  void sample_batch(size_t n, const size_t* s, const size_t* a, size_t* s2, double* r, std::default_random_engine &rng) const;
+
   /*! \brief Rwturns whether a state is terminal or not.
    *
    * \param s state
@@ -213,6 +235,29 @@ public:
    * \return link a valid link index if s1 and s2 can be connected, n_links otherwise. In practice Left (0), Right (1), Forward (2), No Move (3).
    */
   size_t is_connected(size_t s1, size_t s2) const;
+
+  /*! \brief Returns the memory used by each component of the model.
+   *
+   * \return footprint list of (component name, size in bytes).
+   */
+  std::vector<std::pair<std::string, size_t> > memory_footprint() const;
+
+  /*! \brief Returns the number of entries in a row of the transition tensor (one per link).
+   *
+   * \return number of links.
+   */
+  size_t get_row_length() const;
+
+  /*! \brief Returns the stored transition row for a given environment, observation and action.
+   *
+   * \param env environment index.
+   * \param o observation index.
+   * \param a action index.
+   *
+   * \return pointer to the ``n_links`` transition probabilities, or nullptr for S, G and T
+   * whose transitions are not stored.
+   */
+  const double* transition_row(size_t env, size_t o, size_t a) const;
 };
 
 #endif
@@ -12,6 +12,12 @@
 #include <vector>
 #include <iostream>
 #include <tuple>
+#include <random>
+#include <string>
+#include <utility>
+#include <numeric>
+#include <algorithm>
+#include <cstdint>
 
 class Model {
 public:
@@ -116,6 +122,18 @@ public:
    */
   virtual std::tuple<size_t, double> sampleSR(size_t s,size_t a) const = 0;
 
+  /*! \brief Sample a state and reward given an origin state and chosen action, drawing
+   * from the given random engine. Can be called concurrently from several threads as
+   * long as each thread uses its own engine.
+   *
+   * \param s origin state.
+   * \param a chosen action.
+   * \param rng random engine to sample from.
+   *
+   * \return s2 such that s -a-> s2, and the associated reward R(s, a, s2).
+   */
+  virtual std::tuple<size_t, double> sampleSR(size_t s, size_t a, std::default_random_engine &rng) const = 0;
+
   /*! \brief Sample a state, observation and reward given an origin state and chosen acion.
    * @AIToolBox Model interface
    *
@@ -131,6 +149,39 @@ public:
     return std::make_tuple(s2, get_rep(s2), reward);
   };
 
+  /*! \brief Sample a state, observation and reward given an origin state and chosen action,
+   * drawing from the given random engine.
+   *
+   * \param s origin state.
+   * \param a chosen action.
+   * \param rng random engine to sample from.
+   *
+   * \return s2 such that s -a-> s2, and the associated observation and reward R(s, a, s2).
+   */
+  virtual std::tuple<size_t, size_t, double> sampleSOR(size_t s, size_t a, std::default_random_engine &rng) const {
+    size_t s2;
+    double reward;
+    std::tie(s2, reward) = sampleSR(s, a, rng);
+    return std::make_tuple(s2, get_rep(s2), reward);
+  };
+
+  /*! \brief Sample a batch of states and rewards given origin states and chosen actions,
+   * drawing from the given random engine. Equivalent to ``n`` calls to sampleSR, from
+   * arrays holding one entry per sample.
+   *
+   * \param n number of samples.
+   * \param s origin states.
+   * \param a chosen actions.
+   * \param s2 output sampled states, such that s[i] -a[i]-> s2[i].
+   * \param r output rewards R(s[i], a[i], s2[i]).
+   * \param rng random engine to sample from.
+   */
+  virtual void sample_batch(size_t n, const size_t* s, const size_t* a, size_t* s2, double* r, std::default_random_engine &rng) const {
+    for (size_t i = 0; i < n; i++) {
+      std::tie(s2[i], r[i]) = sampleSR(s[i], a[i], rng);
+    }
+  };
+
   /*! \brief Rwturns whether a state is terminal or not.
    * @AIToolBox Model interface
    *
@@ -174,7 +225,7 @@ public:
    * \return number of calls to the sampleSR function.
    */
   int get_bottleneck_calls() const { return n_bottleneck_calls; };
-  int bottleneck_call() const { n_bottleneck_calls ++; }
+  void bottleneck_call() const { n_bottleneck_calls ++; }
 
   /*! \brief Given a state, returns all its possible predecessors.
    *
@@ -202,8 +253,91 @@ public:
    */
   virtual size_t is_connected(size_t s1, size_t s2) const = 0;
 
+  /*! \brief Returns the memory used by each component of the model.
+   *
+   * \return footprint list of (component name, size in bytes).
+   */
+  virtual std::vector<std::pair<std::string, size_t> > memory_footprint() const = 0;
+
+  /*! \brief Returns the number of entries (links) in a row of the stored transition tensor.
+   *
+   * \return number of possible successors stored for each (environment, observation, action).
+   */
+  virtual size_t get_row_length() const = 0;
+
+  /*! \brief Returns the stored transition row for a given environment, observation and action.
+   *
+   * \param env environment index.
+   * \param o observation index.
+   * \param a action index.
+   *
+   * \return pointer to the ``get_row_length()`` transition probabilities, or nullptr if the
+   * row is not explicitly stored by the model.
+   */
+  virtual const double* transition_row(size_t env, size_t o, size_t a) const = 0;
+
 
 protected:
+  /*! \brief Builds the alias tables of the transition rows (Vose's method), so that a
+   * successor can be sampled in constant time. Rows summing to 0 are sampled uniformly.
+   *
+   * \param matrix transition rows, stored contiguously.
+   * \param n_rows number of rows.
+   * \param row_length number of entries in a row.
+   */
+  void build_alias_tables(const double* matrix, size_t n_rows, size_t row_length) {
+    alias_length = row_length;
+    alias_prob.assign(n_rows * row_length, 1.f);
+    alias_link.resize(n_rows * row_length);
+    std::vector<size_t> small, large;
+    std::vector<double> scaled(row_length);
+    for (size_t row = 0; row < n_rows; row++) {
+      const double* p = matrix + row * row_length;
+      float* prob = &alias_prob[row * row_length];
+      uint32_t* link = &alias_link[row * row_length];
+      double nrm = std::accumulate(p, p + row_length, 0.);
+      small.clear();
+      large.clear();
+      for (size_t l = 0; l < row_length; l++) {
+	link[l] = l;
+	scaled[l] = ((nrm > 0) ? p[l] * row_length / nrm : 1.);
+	(scaled[l] < 1. ? small : large).push_back(l);
+      }
+      // Pair each under-full entry with an over-full one; leftovers keep probability 1
+      while (!small.empty() && !large.empty()) {
+	size_t l = small.back(), g = large.back();
+	small.pop_back();
+	large.pop_back();
+	prob[l] = scaled[l];
+	link[l] = g;
+	scaled[g] -= 1. - scaled[l];
+	(scaled[g] < 1. ? small : large).push_back(g);
+      }
+    }
+  };
+
+  /*! \brief Samples an entry of a transition row from the alias tables.
+   *
+   * \param row index of the row given to build_alias_tables.
+   * \param rng random engine to sample from.
+   *
+   * \return the sampled entry (link) of the row.
+   */
+  size_t sample_link(size_t row, std::default_random_engine &rng) const {
+    std::uniform_real_distribution<double> uniform(0., (double) alias_length);
+    double u = uniform(rng);
+    size_t l = std::min((size_t) u, alias_length - 1);
+    size_t i = row * alias_length + l;
+    return ((u - l < alias_prob[i]) ? l : alias_link[i]);
+  };
+
+  /*! \brief Returns the memory used by the alias tables.
+   */
+  size_t alias_bytes() const { return alias_prob.capacity() * sizeof(float) + alias_link.capacity() * sizeof(uint32_t); };
+
+  std::vector<float> alias_prob; /*!< Probability of keeping each entry of the alias tables */
+  std::vector<uint32_t> alias_link; /*!< Alias of each entry of the alias tables */
+  size_t alias_length = 0; /*!< Row length of the alias tables */
   bool is_mdp; /*!< True iff mdp interpretation is possible */
   size_t n_states; /*!< Number of states in the model */
   size_t n_actions;  /*!< Number of actions in the model */
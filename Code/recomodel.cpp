@@ -94,7 +94,7 @@ size_t Recomodel::is_connected(size_t s1, size_t s2) const {
   int suffix_s1 = s1 % pows[0];
   suffix_s1 = ((suffix_s1 >= acpows[1] || s1 < pows[0])  ? suffix_s1 - acpows[1] : suffix_s1 + pows[0] - acpows[1]);
   // Prefix of s2
-  div_t aux = div(s2, n_actions);
+  div_t aux = div((int) s2, (int) n_actions);
   int prefix_s2 = aux.quot - acpows[1];
   size_t last_s2 = aux.rem - 1;
   if (aux.rem == 0) {
@@ -317,6 +317,9 @@ void Recomodel::load_transitions(std::string tfile, bool precision /* =false */,
       }
     }
   }
+
+  // Sampling tables
+  build_alias_tables(transition_matrix, (is_mdp ? 1 : n_environments) * n_observations * n_actions, n_actions);
 }
 
 /**
@@ -343,14 +346,31 @@ double Recomodel::getExpectedReward(size_t s1, size_t a, size_t s2) const {
  * SAMPLESR
  */
 std::tuple<size_t, double> Recomodel::sampleSR(size_t s,size_t a) const {
+  return sampleSR(s, a, generator);
+}
+
+/**
+ * SAMPLESR (given random engine)
+ */
+std::tuple<size_t, double> Recomodel::sampleSR(size_t s, size_t a, std::default_random_engine &rng) const {
   // Sample next state according to transition function
-  std::discrete_distribution<int> distribution (&transition_matrix[index(get_env(s), get_rep(s), a, 0)], &transition_matrix[index(get_env(s), get_rep(s), a, n_actions)]);
-  size_t s2_link = distribution(generator);
+  size_t s2_link = sample_link(index(get_env(s), get_rep(s), a, 0) / n_actions, rng);
   // Return sampled state and rewards
   size_t s2 = get_env(s) * n_observations + next_state(get_rep(s), s2_link);
   return std::make_tuple(s2, ((s2_link == a) ? rewards[a] : 0));
 }
 
+/**
+ * SAMPLE_BATCH
+ */
+void Recomodel::sample_batch(size_t n, const size_t* s, const size_t* a, size_t* s2, double* r, std::default_random_engine &rng) const {
+  for (size_t i = 0; i < n; i++) {
+    size_t s2_link = sample_link(index(get_env(s[i]), get_rep(s[i]), a[i], 0) / n_actions, rng);
+    s2[i] = get_env(s[i]) * n_observations + next_state(get_rep(s[i]), s2_link);
+    r[i] = ((s2_link == a[i]) ? rewards[a[i]] : 0);
+  }
+}
+
 /**
  * ISTERMINAL
  */
@@ -370,7 +390,7 @@ bool Recomodel::isInitial(size_t s) const {
  */
 std::vector<size_t> Recomodel::previous_states(size_t state) const {
   size_t obs = get_rep(state), env = get_env(state);
-  div_t aux = div(obs, n_actions);
+  div_t aux = div((int) obs, (int) n_actions);
   int prefix_s2 = ((aux.rem == 0) ? aux.quot - 1 : aux.quot);
   // If starting states
   if (obs == 0) {
@@ -404,5 +424,29 @@ std::vector<size_t> Recomodel::reachable_states(size_t state) const {
   return aux;
 }
 
+/**
+ * MEMORY_FOOTPRINT
+ */
+std::vector<std::pair<std::string, size_t> > Recomodel::memory_footprint() const {
+  size_t n_rows = (is_mdp ? 1 : n_environments) * n_observations * n_actions;
+  std::vector<std::pair<std::string, size_t> > footprint;
+  footprint.push_back(std::make_pair("transition_matrix", n_rows * n_actions * sizeof(double)));
+  footprint.push_back(std::make_pair("alias tables", alias_bytes()));
+  footprint.push_back(std::make_pair("rewards", n_actions * sizeof(double)));
+  footprint.push_back(std::make_pair("pows, acpows", 2 * hlength * sizeof(int)));
+  return footprint;
+}
 
+/**
+ * GET_ROW_LENGTH
+ */
+size_t Recomodel::get_row_length() const {
+  return n_actions;
+}
 
+/**
+ * TRANSITION_ROW
+ */
+const double* Recomodel::transition_row(size_t env, size_t o, size_t a) const {
+  return &transition_matrix[index((is_mdp ? 0 : env), o, a, 0)];
+}
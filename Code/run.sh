@@ -23,10 +23,34 @@ VERBOSE="0"
 BELIEFSIZE="500"
 EXPLORATION="10000"
 HORIZON="2"
+THREADS="1"
+PARALLEL="root"
+MEMORY="0"
+DEADLINE="0"
+BATCH="1"
+LEAVES="rollout"
+POLICY="none"
+POLICYENV="0"
+WIDENING="0"
+TRANSPOSITIONS="0"
+BOOK="0"
+BOOKFILE="none"
+PONDER="0"
+PARTICLECAP="0"
+STRATIFIED="0"
+EARLYSTOP="0"
+BUDGETFLOOR="1"
+SESSIONBUDGET="0"
+IDENTIFIED="0"
+SUPPORTTHRESHOLD="0"
+SUPPORTSIZE="0"
+CLUSTERS="0"
+THINK="0"
+FLOATBELIEFS=""
 COMPILE=false
 
 # SET  ARGUMENTS FROM CMD LINE
-while getopts "m:d:n:k:u:g:s:h:e:x:b:cpv" opt; do
+while getopts "m:d:n:k:u:g:s:h:e:x:b:t:r:l:w:z:q:o:j:i:a:B:P:K:D:F:G:I:R:N:C:T:cfpvyS" opt; do
   case $opt in
     m)
       MODE=$OPTARG
@@ -67,9 +91,81 @@ while getopts "m:d:n:k:u:g:s:h:e:x:b:cpv" opt; do
     x)
       EXPLORATION=$OPTARG
       ;;
+    t)
+      THREADS=$OPTARG
+      ;;
+    r)
+      PARALLEL=$OPTARG
+      ;;
+    l)
+      MEMORY=$OPTARG
+      ;;
+    w)
+      DEADLINE=$OPTARG
+      ;;
+    z)
+      BATCH=$OPTARG
+      ;;
+    q)
+      LEAVES=$OPTARG
+      ;;
+    o)
+      POLICY=$OPTARG
+      ;;
+    y)
+      POLICYENV=1
+      ;;
+    j)
+      WIDENING=$OPTARG
+      ;;
+    i)
+      TRANSPOSITIONS=$OPTARG
+      ;;
+    a)
+      BOOK=$OPTARG
+      ;;
+    B)
+      BOOKFILE=$OPTARG
+      ;;
+    P)
+      PONDER=$OPTARG
+      ;;
+    K)
+      PARTICLECAP=$OPTARG
+      ;;
+    S)
+      STRATIFIED=1
+      ;;
+    D)
+      EARLYSTOP=$OPTARG
+      ;;
+    F)
+      BUDGETFLOOR=$OPTARG
+      ;;
+    G)
+      SESSIONBUDGET=$OPTARG
+      ;;
+    I)
+      IDENTIFIED=$OPTARG
+      ;;
+    R)
+      SUPPORTTHRESHOLD=$OPTARG
+      ;;
+    N)
+      SUPPORTSIZE=$OPTARG
+      ;;
+    C)
+      CLUSTERS=$OPTARG
+      ;;
+    T)
+      THINK=$OPTARG
+      ;;
     c)
       COMPILE=true
       ;;
+    f)
+      FLOATBELIEFS="-DPAMCP_FLOAT_BELIEFS"
+      ;;
     \?)
       echo "Invalid option: -$OPTARG" >&2
       exit 1
@@ -126,13 +222,32 @@ if [ $MODE = "mdp" ]; then
     echo "Running mainMDP on $BASE"
     ./mainMDP $BASE $DATA $DISCOUNT $STEPS $EPSILON $PRECISION $VERBOSE
     echo
+# INSPECTOR
+elif [ $MODE = "inspect" ]; then
+# COMPILE
+    if [ "$COMPILE" = true ]; then
+	echo
+	echo "Compiling mainInspect"
+	$GCC -O3 -Wl,-rpath,$STDLIB -DNITEMSPRM=$NITEMS -DHISTPRM=$HIST -DNPROFILESPRM=$PROFILES -std=c++11 mazemodel.cpp recomodel.cpp main_inspect.cpp -o mainInspect -lz -lboost_iostreams
+	if [ $? -ne 0 ]; then
+	    echo "Compilation failed!"
+	    echo "exit"
+	    exit 1
+	fi
+    fi
+
+# RUN
+    echo
+    echo "Inspecting $BASE"
+    ./mainInspect $BASE $DATA $PRECISION $VERBOSE
+    echo
 # POMDPs
 else
 # COMPILE
     if [ "$COMPILE" = true ]; then
 	echo
 	echo "Compiling mainMEMDP"
-	$GCC -O3 -Wl,-rpath,$STDLIB -DNITEMSPRM=$NITEMS -DHISTPRM=$HIST -DNPROFILESPRM=$PROFILES -std=c++11 mazemodel.cpp recomodel.cpp utils.cpp main_MEMDP.cpp -o mainMEMDP -I $AIINCLUDE -I $EIGEN -L $LPSOLVE -L $AIBUILD -l AIToolboxMDP -l AIToolboxPOMDP -l lpsolve55 -lz -lboost_iostreams
+	$GCC -O3 -Wl,-rpath,$STDLIB -DNITEMSPRM=$NITEMS -DHISTPRM=$HIST -DNPROFILESPRM=$PROFILES $FLOATBELIEFS -std=c++11 -march=native -pthread mazemodel.cpp recomodel.cpp utils.cpp main_MEMDP.cpp -o mainMEMDP -I $AIINCLUDE -I $EIGEN -L $LPSOLVE -L $AIBUILD -l AIToolboxMDP -l AIToolboxPOMDP -l lpsolve55 -lz -lboost_iostreams
 	if [ $? -ne 0 ]
 	then
 	    echo "Compilation failed!"
@@ -144,6 +259,6 @@ else
 # RUN
     echo
     echo "Running mainMEMDP on $BASE with $MODE solver"
-    ./mainMEMDP $BASE $DATA $MODE $DISCOUNT $STEPS $HORIZON $EPSILON $EXPLORATION $BELIEFSIZE $PRECISION $VERBOSE
+    ./mainMEMDP $BASE $DATA $MODE $DISCOUNT $STEPS $HORIZON $EPSILON $EXPLORATION $BELIEFSIZE $PRECISION $VERBOSE $THREADS $PARALLEL $MEMORY $DEADLINE $BATCH $LEAVES $POLICY $POLICYENV $WIDENING $TRANSPOSITIONS $BOOK $BOOKFILE $PONDER $PARTICLECAP $STRATIFIED $EARLYSTOP $BUDGETFLOOR $SESSIONBUDGET $IDENTIFIED $SUPPORTTHRESHOLD $SUPPORTSIZE $CLUSTERS $THINK
     echo
 fi
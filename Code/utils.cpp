@@ -54,7 +54,7 @@ double Stats::get_mean(int cluster) {
 	return 0.;
       }
     } else {
-      double v, l = 0;
+      double v = 0, l = 0;
       for (int i = 0; i < size; i++) {
 	v += acc_mean[i];
 	l += lengths[i];
@@ -113,6 +113,39 @@ std::vector<std::pair<int, std::vector<std::pair<size_t, size_t> > > > load_test
   return test_sessions;
 }
 
+/**
+ * LOAD_ACTION_COUNTS
+ */
+std::vector<double> load_action_counts(std::string sfile, size_t n_observations, size_t n_actions, size_t n_environments /* = 0 */) {
+  std::vector<double> counts(n_observations * n_actions, 0.);
+  std::vector<double> env_counts(n_environments * n_observations * n_actions, 0.);
+  auto sessions = load_test_sessions(sfile);
+  assert(("No session in the rollout policy file", sessions.size() > 0));
+  for (auto it = begin(sessions); it != end(sessions); ++it) {
+    size_t env = std::get<0>(*it);
+    for (auto it2 = begin(std::get<1>(*it)); it2 != end(std::get<1>(*it)); ++it2) {
+      size_t o = std::get<0>(*it2), a = std::get<1>(*it2);
+      if (o >= n_observations || a >= n_actions) continue;
+      counts.at(o * n_actions + a) += 1.;
+      if (n_environments && env < n_environments) {
+	env_counts.at((env * n_observations + o) * n_actions + a) += 1.;
+      }
+    }
+  }
+  if (!n_environments) {
+    return counts;
+  }
+
+  // Unseen (environment, observation) rows fall back to the observation counts
+  for (size_t s = 0; s < n_environments * n_observations; s++) {
+    double* row = &env_counts[s * n_actions];
+    if (std::accumulate(row, row + n_actions, 0.) == 0) {
+      std::copy(&counts[(s % n_observations) * n_actions], &counts[(s % n_observations) * n_actions] + n_actions, row);
+    }
+  }
+  return env_counts;
+}
+
 /**
  * GET_PREDICTION
  */
@@ -171,6 +204,21 @@ void print_evaluation_result(int n_environments,
   }
 }
 
+/**
+ * PRINT_STEP_RESULTS
+ */
+void print_step_results(const std::vector<double> &simulations,
+			const std::vector<double> &outcomes,
+			const std::vector<double> &counts,
+			std::string title)
+{
+  size_t last = counts.size() - 1;
+  for (size_t s = 0; s <= last; s++) {
+    if (!counts[s]) continue;
+    std::cout << "\n      > step " << s + 1 << ((s == last) ? "+" : "") << ": avg simulations " << simulations[s] / counts[s] << ", " << title << " " << outcomes[s] / counts[s];
+  }
+}
+
 /**
  * MAKE_INITIAL_PREDICTION (POMDP policy)
  */
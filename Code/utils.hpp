@@ -18,7 +18,10 @@
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <iomanip>
 #include <fstream>
+#include <chrono>
+#include <thread>
 #include <AIToolbox/MDP/Policies/Policy.hpp>
 #include <AIToolbox/POMDP/Policies/Policy.hpp>
 #include <AIToolbox/POMDP/Algorithms/POMCP.hpp>
@@ -63,6 +66,21 @@ public:
  */
 std::vector<std::pair<int, std::vector<std::pair<size_t, size_t> > > > load_test_sessions(std::string sfile);
 
+/*! \brief Returns the number of times each action is chosen after
+ * each observation in a session file, as a rollout policy for PAMCP.
+ *
+ * \param sfile full path to a session file, in the base_name.test format.
+ * \param n_observations number of observations of the model.
+ * \param n_actions number of actions of the model.
+ * \param n_environments if non zero, the counts are kept per environment:
+ * an (environment, observation) never seen in the file takes the counts
+ * of the observation over all environments.
+ *
+ * \return action counts, n_actions per row, with one row per observation
+ * or per state (environment * n_observations + observation).
+ */
+std::vector<double> load_action_counts(std::string sfile, size_t n_observations, size_t n_actions, size_t n_environments = 0);
+
 /*! \brief Pretty-printer for the results returned by one of the
  * evaluation routines.
  *
@@ -77,6 +95,18 @@ void print_evaluation_result(int n_environments,
 			     std::vector<std::string> titles,
 			     bool verbose /* = false*/);
 
+/*! \brief Prints the average simulations and outcome of the decisions per step of the sessions.
+ *
+ * \param simulations the total number of simulations of the decisions at each step.
+ * \param outcomes the total outcome of the decisions at each step.
+ * \param counts the number of decisions at each step, the last one counting all the later steps.
+ * \param title the name of the outcome.
+ */
+void print_step_results(const std::vector<double> &simulations,
+			const std::vector<double> &outcomes,
+			const std::vector<double> &counts,
+			std::string title);
+
 /*! \brief Returns a 0-1 accuracy score given a prediction and ground-truth.
  *
  * \param predicted the predicted action.
@@ -151,11 +181,7 @@ std::pair<AIToolbox::POMDP::Belief, size_t> make_initial_prediction(const Model&
   AIToolbox::POMDP::Belief env_belief = AIToolbox::POMDP::Belief(model.getE());
   env_belief.fill(1.0 / model.getE());
   size_t prediction = pamcp.sampleAction(env_belief, init_observation, horizon, true);
-
-  auto & graph_ = pamcp.getGraph();
-  for (size_t a = 0; a < model.getA(); a++) {
-    action_scores.at(a) = graph_.children[a].V;
-  }
+  action_scores = pamcp.getActionScores();
 
   return std::make_pair(env_belief, prediction);
 }
@@ -194,10 +220,7 @@ std::pair<bool, size_t> make_prediction(const Model& model, AIToolbox::POMDP::PO
 template<typename M>
 std::pair<bool, size_t> make_prediction(const Model& model, AIToolbox::POMDP::PAMCP<M> &pamcp, AIToolbox::POMDP::Belief &b, size_t o, size_t a, int horizon, std::vector<double> &action_scores) {
   size_t prediction = pamcp.sampleAction(a, o, horizon);
-  auto & graph_ = pamcp.getGraph();
-  for (size_t action = 0; action < model.getA(); action++) {
-    action_scores.at(action) = graph_.children[action].V;
-  }
+  action_scores = pamcp.getActionScores();
   return std::make_pair(true, prediction);
 }
 
@@ -239,7 +262,7 @@ std::pair<double, double> identification_score(const Model& model, AIToolbox::PO
 
 // PAMCP
 template<typename M>
-std::pair<double, double> identification_score(const Model& model, AIToolbox::POMDP::PAMCP<M> pamcp, AIToolbox::POMDP::Belief b, size_t o, int cluster) {
+std::pair<double, double> identification_score(const Model& model, const AIToolbox::POMDP::PAMCP<M> &pamcp, AIToolbox::POMDP::Belief b, size_t o, int cluster) {
   std::vector<double> scores = pamcp.getEnvBelief();
   /*
     std::vector<double> scores(model.getE());
@@ -258,24 +281,72 @@ std::pair<double, double> identification_score(const Model& model, AIToolbox::PO
   return std::make_pair(accuracy, 1.0 / rank);
 }
 
+/*! \brief Returns the memory used by the search tree of a solver.
+ *
+ * \param solver the solver to evaluate (MDP policy, POMDP policy, POMCP or PAMCP).
+ *
+ * \return the number of bytes used by the search tree, 0 if the solver does not report it.
+ */
+template<typename S>
+size_t search_memory(const S &) {
+  return 0;
+}
+
+// PAMCP
+template<typename M>
+size_t search_memory(const AIToolbox::POMDP::PAMCP<M> &pamcp) {
+  return pamcp.getMemoryUsage();
+}
+
+/*! \brief Returns the number of simulations run by a solver for its last prediction.
+ *
+ * \param solver the solver to evaluate (MDP policy, POMDP policy, POMCP or PAMCP).
+ *
+ * \return the number of simulations, 0 if the solver does not report it.
+ */
+template<typename S>
+unsigned search_simulations(const S &) {
+  return 0;
+}
+
+// PAMCP
+template<typename M>
+unsigned search_simulations(const AIToolbox::POMDP::PAMCP<M> &pamcp) {
+  return pamcp.getSimulations();
+}
+
+/*! \brief Returns the memory used by the search tree of a solver, as
+ * shown next to the progress of the evaluation.
+ */
+template<typename S>
+std::string search_memory_str(const S &solver) {
+  size_t bytes = search_memory(solver);
+  if (!bytes) return "";
+  std::ostringstream str;
+  str << " (tree " << std::fixed << std::setprecision(1) << bytes / 1048576. << " MB)";
+  return str.str();
+}
+
 /*! \brief Evaluates a given solver using external test sequences (sequence of (observation, action)) stored in a file.
  *
  * \param sfile full path to the base_name.test file.
  * \param model underlying MEMDP model.
- * \param solver the solver to be evaluated.
+ * \param solver the solver to be evaluated, which keeps its state (e.g. the opening book).
  * \param policy AIToolbox POMDP::policy.
  * \param discount discount factor in the POMDP model.
  * \param horizon planning horizon for action sampling.
  * \param rewards stored reward values.
  * \param verbose if true, increases the verbosity. Defaults to false.
+ * \param think_time milliseconds waited before each decision, as a user reading the previous recommendation. Defaults to 0.
  */
 template<typename M>
 void evaluate_from_file(std::string sfile,
 			const Model& model,
-			M solver,
+			M& solver,
 			unsigned int horizon,
 			bool verbose=false,
-			bool supervised=true) {
+			bool supervised=true,
+			unsigned int think_time=0) {
   // Aux variables
   size_t observation = 0, action, prediction;
   int user = 0, cluster, session_length, chorizon;
@@ -293,7 +364,12 @@ void evaluate_from_file(std::string sfile,
   bool has_prec;
 
   // Load test sessions
-  double total_length = 0.;
+  double total_length = 0., total_simulations = 0.;
+  size_t peak_memory = 0, n_decisions = 0;
+  // Simulations and accuracy of the predictions per step of the sessions (the last one for all the later steps)
+  const size_t max_step = 10;
+  unsigned simulations = 0;
+  std::vector< double > step_simulations(max_step + 1, 0.), step_accuracy(max_step + 1, 0.), step_count(max_step + 1, 0.);
   std::vector<std::pair<int, std::vector<std::pair<size_t, size_t> > > > aux = load_test_sessions(sfile);
   for (auto it = begin(aux); it != end(aux); ++it) {
     // Identity
@@ -302,7 +378,7 @@ void evaluate_from_file(std::string sfile,
     session_length = std::get<1>(*it).size();
     total_length += session_length;
     assert(("Empty test user session", session_length > 0));
-    std::cerr << "\r     User " << user << "/" << aux.size() << std::flush;
+    std::cerr << "\r     User " << user << "/" << aux.size() << search_memory_str(solver) << std::flush;
 
     // Reset
     cdiscount = 1.;
@@ -312,8 +388,11 @@ void evaluate_from_file(std::string sfile,
 
     // Make initial guess
     std::tie(belief, prediction) = make_initial_prediction(model, solver, chorizon, action_scores);
+    simulations = search_simulations(solver);
+    total_simulations += simulations; n_decisions++;
     if (!verbose) {std::cerr.setstate(std::ios_base::failbit);}
-    for (auto it2 = begin(std::get<1>(*it)); it2 != end(std::get<1>(*it)); ++it2) {
+    size_t step = 0;
+    for (auto it2 = begin(std::get<1>(*it)); it2 != end(std::get<1>(*it)); ++it2, ++step) {
       // Update
       if (!model.isInitial(std::get<0>(*it2))) {
 	double r = (model.mdp_enabled() ? model.getExpectedReward(observation, prediction, std::get<0>(*it2)) : model.getExpectedReward(cluster * model.getO() + observation, prediction, cluster * model.getO() + std::get<0>(*it2)));
@@ -326,12 +405,20 @@ void evaluate_from_file(std::string sfile,
       // Predict
       observation  = std::get<0>(*it2);
       if (!model.isInitial(observation)) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(think_time));
 	std::tie(has_prec, prediction) = make_prediction(model, solver, belief, observation, (supervised ? action : prediction), chorizon, action_scores);
+	simulations = search_simulations(solver);
+	total_simulations += simulations; n_decisions++;
       }
 
       // Evaluate
       action = std::get<1>(*it2);
       accuracy += accuracy_score(prediction, action);
+      // A decision kept over an initial observation runs no new simulations
+      step_simulations[std::min(step, max_step)] += simulations;
+      simulations = 0;
+      step_accuracy[std::min(step, max_step)] += accuracy_score(prediction, action);
+      step_count[std::min(step, max_step)]++;
       precision += has_prec ? avprecision_score(action_scores, action) : -1.;
       auto aux = identification_score(model, solver, belief, observation, cluster);
       identity += std::get<0>(aux);
@@ -346,6 +433,7 @@ void evaluate_from_file(std::string sfile,
     discounted_reward_s.update(cluster, discounted_reward);
     identification_s.update(cluster, identity / session_length);
     identification_precision_s.update(cluster, identity_precision / session_length);
+    peak_memory = std::max(peak_memory, search_memory(solver));
   }
 
   // Only output relevant metrics
@@ -367,6 +455,15 @@ void evaluate_from_file(std::string sfile,
   print_evaluation_result(model.getE(), results, titles, verbose);
   std::cout << "\n      > avglng: " << (float)total_length / (float)user;
   std::cout << "\n      > avg mcp makeparticles calls: " << (float)model.get_bottleneck_calls() / (float)user;
+  if (peak_memory) {
+    std::cout << "\n      > peak search tree memory: " << peak_memory / 1048576. << " MB";
+  }
+  if (total_simulations) {
+    std::cout << "\n      > avg simulations per decision: " << total_simulations / n_decisions;
+    if (verbose) {
+      print_step_results(step_simulations, step_accuracy, step_count, "acc");
+    }
+  }
   std::cout << "\n\n";
 }
 
@@ -374,21 +471,23 @@ void evaluate_from_file(std::string sfile,
  *
  * \param sfile full path to the base_name.test file.
  * \param model underlying MEMDP model.
- * \param solver the solver to be evaluated.
+ * \param solver the solver to be evaluated, which keeps its state (e.g. the opening book).
  * \param policy AIToolbox POMDP::policy.
  * \param discount discount factor in the POMDP model.
  * \param horizon planning horizon for action sampling.
  * \param rewards stored reward values.
  * \param verbose if true, increases the verbosity. Defaults to false.
+ * \param think_time milliseconds waited before each decision, as a user reading the previous recommendation. Defaults to 0.
  */
 template<typename M>
 void evaluate_interactive(int n_sessions,
 			  const Model& model,
-			  M solver,
+			  M& solver,
 			  unsigned int horizon,
 			  bool verbose=false,
 			  bool supervised=false, //true only works if full policy is computed (i.e. pbvi)
-			  int session_length_max=400) {
+			  int session_length_max=400,
+			  unsigned int think_time=0) {
   // Aux variables
   size_t observation = 0, prev_observation, action, prediction;
   size_t state, prev_state;
@@ -399,6 +498,12 @@ void evaluate_interactive(int n_sessions,
   AIToolbox::POMDP::Belief belief;
   std::vector< double > action_scores(model.getA(), 0);
   int n_failures = 0;
+  size_t peak_memory = 0, n_decisions = 0;
+  double total_simulations = 0.;
+  // Simulations and reward of the decisions per step of the sessions (the last one for all the later steps)
+  const size_t max_step = 10;
+  unsigned simulations = 0;
+  std::vector< double > step_simulations(max_step + 1, 0.), step_reward(max_step + 1, 0.), step_count(max_step + 1, 0.);
   Stats session_length_s(model.getE());
   Stats success_s(model.getE());
   Stats total_reward_s(model.getE());
@@ -411,7 +516,7 @@ void evaluate_interactive(int n_sessions,
   n_sessions = n_sessions - n_sessions % (int)(model.getE());
   for (int user = 0; user < n_sessions; user++) {
     cluster = user / subgroup_size;
-    std::cerr << "\r     User " << user + 1 << "/" << n_sessions << std::string(15, ' ');
+    std::cerr << "\r     User " << user + 1 << "/" << n_sessions << search_memory_str(solver) << std::string(15, ' ');
 
     // Reset
     chorizon = horizon;
@@ -421,6 +526,7 @@ void evaluate_interactive(int n_sessions,
     // Make initial guess
     state = cluster * model.getO() + 0;
     std::tie(belief, prediction) = make_initial_prediction(model, solver, chorizon, action_scores);
+    simulations = search_simulations(solver);
     if (!verbose) {std::cerr.setstate(std::ios_base::failbit);}
     while(!model.isTerminal(state) && session_length < session_length_max) {
       // Sample next state
@@ -428,9 +534,17 @@ void evaluate_interactive(int n_sessions,
       std::tie(state, observation, r) = model.sampleSOR(state, prediction);
       // Update
       total_reward += r;
+      size_t step = std::min((size_t)session_length, max_step);
+      // Only the decisions played count, not the one after the last step
+      step_simulations[step] += simulations;
+      total_simulations += simulations; n_decisions++;
+      step_reward[step] += r;
+      step_count[step]++;
       chorizon = ((chorizon > 1) ? chorizon - 1 : 1 );
       // Predict
+      std::this_thread::sleep_for(std::chrono::milliseconds(think_time));
       prediction = std::get<1>(make_prediction(model, solver, belief, observation, (supervised ? model.is_connected(prev_state, state) : prediction), chorizon, action_scores));
+      simulations = search_simulations(solver);
 
       // Evaluate
       session_length++;
@@ -441,6 +555,7 @@ void evaluate_interactive(int n_sessions,
 
     // Update scores
     if (!verbose) {std::cerr.clear();}
+    peak_memory = std::max(peak_memory, search_memory(solver));
     // identity score can always be computed
     identification_s.update(cluster, identity / session_length);
     identification_precision_s.update(cluster, identity_precision / session_length);
@@ -480,6 +595,16 @@ void evaluate_interactive(int n_sessions,
   }
   print_evaluation_result(model.getE(), results, titles, verbose);
   std::cout << "\n      > " << n_failures << " / " << n_sessions << " reach failures\n";
+  if (peak_memory) {
+    std::cout << "      > peak search tree memory: " << peak_memory / 1048576. << " MB\n";
+  }
+  if (total_simulations) {
+    std::cout << "      > avg simulations per decision: " << total_simulations / n_decisions;
+    if (verbose) {
+      print_step_results(step_simulations, step_reward, step_count, "avgrw");
+    }
+    std::cout << "\n";
+  }
   std::cout << "\n\n";
 }
 #endif